@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * Embedded data layout of the OnSemi AR0822 CMOS Image Sensor, as captured
+ * from the metadata pad of the ar0822 driver. This header is shared by the
+ * driver and userspace consumers.
+ *
+ * Copyright (C) 2025 Kurokesu UAB.
+ */
+
+#ifndef AR0822_EMBEDDED_DATA_H
+#define AR0822_EMBEDDED_DATA_H
+
+#include <linux/types.h>
+#ifndef __KERNEL__
+#include <stddef.h> /* NULL */
+#endif
+
+/*
+ * The metadata pad carries up to AR0822_NUM_EMBEDDED_LINES lines per frame,
+ * depending on the embedded data control. The first AR0822_EMBEDDED_REG_LINES
+ * hold register data and are sent before the image, the remaining lines hold
+ * statistics and are sent after it.
+ *
+ * Lines are packed like RAW12 pixels, every 3rd byte holds the low nibbles of
+ * the two bytes before it and carries no data. A line of 3840 data bytes thus
+ * takes AR0822_EMBEDDED_LINE_WIDTH bytes.
+ */
+#define AR0822_EMBEDDED_LINE_WIDTH 5760 // 3840 + padding bytes (every 3rd byte)
+#define AR0822_NUM_EMBEDDED_LINES 4
+#define AR0822_EMBEDDED_REG_LINES 2
+#define AR0822_EMBEDDED_STATS_LINES 2
+#define AR0822_EMBEDDED_PAD_PERIOD 3 // Every 3rd byte is padding
+
+/*
+ * Register lines start with AR0822_EMBEDDED_FORMAT_CODE, followed by tag and
+ * value byte pairs. A register block starts with the address MSB and LSB tags,
+ * each data tag then holds one register byte and increments the address.
+ * 16-bit registers are sent MSB first. The end tag terminates the line.
+ */
+#define AR0822_EMBEDDED_FORMAT_CODE 0x0A
+#define AR0822_EMBEDDED_TAG_ADDR_MSB 0xAA
+#define AR0822_EMBEDDED_TAG_ADDR_LSB 0xA5
+#define AR0822_EMBEDDED_TAG_DATA 0x5A
+#define AR0822_EMBEDDED_TAG_END 0x07
+
+/*
+ * Registers of interest for per-frame metadata. The blocks present in a line
+ * are described by the line itself, which registers are included depends on
+ * the sensor configuration. Check the result of ar0822_embedded_reg16().
+ */
+#define AR0822_EMBEDDED_REG_FRAME_LENGTH_LINES 0x300A
+#define AR0822_EMBEDDED_REG_LINE_LENGTH_PCK 0x300C
+#define AR0822_EMBEDDED_REG_COARSE_INTEGRATION_TIME 0x3012
+#define AR0822_EMBEDDED_REG_FRAME_COUNT 0x303A
+#define AR0822_EMBEDDED_REG_TEMPSENS1_DATA 0x30B2
+#define AR0822_EMBEDDED_REG_TEMPSENS1_CALIB1 0x30C6
+#define AR0822_EMBEDDED_REG_TEMPSENS1_CALIB2 0x30C8
+#define AR0822_EMBEDDED_REG_SENSOR_GAIN 0x5900
+
+/*
+ * Decode the register data of one embedded line. Each register byte found at
+ * an address in [base, base + size) is stored to regs[addr - base] and marked
+ * in valid[addr - base] if valid is not NULL. Returns the amount of register
+ * bytes stored, or -1 if the line doesn't hold register data.
+ */
+static inline int ar0822_embedded_parse(const __u8 *line, unsigned int width,
+					__u16 base, __u8 *regs, __u8 *valid,
+					unsigned int size)
+{
+	unsigned int i, pos = 0;
+	__u16 addr = 0;
+	__u8 byte, tag = 0;
+	int amount = 0;
+
+	for (i = 0; i < width; i++) {
+		if (i % AR0822_EMBEDDED_PAD_PERIOD ==
+		    AR0822_EMBEDDED_PAD_PERIOD - 1)
+			continue;
+
+		byte = line[i];
+
+		if (pos++ == 0) {
+			if (byte != AR0822_EMBEDDED_FORMAT_CODE)
+				return -1;
+			continue;
+		}
+
+		/* Odd data bytes are tags, even ones their values */
+		if (pos % 2 == 0) {
+			tag = byte;
+			if (tag == AR0822_EMBEDDED_TAG_END)
+				break;
+			continue;
+		}
+
+		switch (tag) {
+		case AR0822_EMBEDDED_TAG_ADDR_MSB:
+			addr = (addr & 0x00FF) | byte << 8;
+			break;
+		case AR0822_EMBEDDED_TAG_ADDR_LSB:
+			addr = (addr & 0xFF00) | byte;
+			break;
+		case AR0822_EMBEDDED_TAG_DATA:
+			if (addr >= base &&
+			    (unsigned int)(addr - base) < size) {
+				regs[addr - base] = byte;
+				if (valid)
+					valid[addr - base] = 1;
+				amount++;
+			}
+			addr++;
+			break;
+		default:
+			/* Unknown tag, the rest of the line is not trusted */
+			return amount;
+		}
+	}
+
+	return amount;
+}
+
+/*
+ * Read a 16-bit register from the output of ar0822_embedded_parse(), which
+ * must have been given the valid array. Returns 0 on success, or -1 if either
+ * byte of the register was not in the line.
+ */
+static inline int ar0822_embedded_reg16(const __u8 *regs, const __u8 *valid,
+					__u16 base, unsigned int size,
+					__u16 reg, __u16 *val)
+{
+	unsigned int offset;
+
+	/* Registers below base fail like in ar0822_embedded_parse() */
+	if (reg < base)
+		return -1;
+
+	offset = reg - base;
+	if (offset + 1 >= size || !valid[offset] || !valid[offset + 1])
+		return -1;
+
+	*val = regs[offset] << 8 | regs[offset + 1];
+
+	return 0;
+}
+
+/*
+ * Statistics lines follow the register lines and carry the sensor statistics
+ * as 12-bit words in the RAW12 packing of the line. The meaning of the words
+ * and the window they are computed over are not described here. Returns NULL
+ * if statistics line i is not part of the lines captured.
+ */
+static inline const __u8 *ar0822_embedded_stats_line(const __u8 *data,
+						     unsigned int lines,
+						     unsigned int i)
+{
+	if (AR0822_EMBEDDED_REG_LINES + i >= lines)
+		return NULL;
+
+	return data + (AR0822_EMBEDDED_REG_LINES + i) *
+			      AR0822_EMBEDDED_LINE_WIDTH;
+}
+
+/*
+ * Unpack the 12-bit words of a statistics line, every 3 bytes hold the high
+ * bytes of two words followed by their low nibbles. Returns the amount of
+ * words stored.
+ */
+static inline unsigned int ar0822_embedded_unpack12(const __u8 *line,
+						    unsigned int width,
+						    __u16 *words,
+						    unsigned int amount)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i + 2 < width && n + 1 < amount; i += 3) {
+		words[n++] = line[i] << 4 | (line[i + 2] & 0x0F);
+		words[n++] = line[i + 1] << 4 | line[i + 2] >> 4;
+	}
+
+	return n;
+}
+
+/*
+ * Temperatures of the two calibration readings, in millidegrees Celsius.
+ * These are the calibration points of other OnSemi sensors, they are not
+ * documented for the AR0822 and have not been checked against a probe.
+ */
+#define AR0822_TEMPSENS_CALIB1_MILLIC 55000
+#define AR0822_TEMPSENS_CALIB2_MILLIC 70000
+
+/*
+ * Convert a temperature sensor reading to millidegrees Celsius, interpolating
+ * between the calibration readings taken at calib1_millic and calib2_millic.
+ * Returns 0 on success, or -1 if the calibration is not usable.
+ */
+static inline int ar0822_temperature(__u16 data, __u16 calib1, __u16 calib2,
+				     __s32 calib1_millic, __s32 calib2_millic,
+				     __s32 *millic)
+{
+	if (calib2 == calib1)
+		return -1;
+
+	*millic = calib1_millic + ((__s32)data - calib1) *
+					  (calib2_millic - calib1_millic) /
+					  ((__s32)calib2 - calib1);
+
+	return 0;
+}
+
+#endif /* AR0822_EMBEDDED_DATA_H */
@@ -5,29 +5,53 @@
  * Copyright (C) 2025 Kurokesu UAB.
  */
 
+#include <linux/bitmap.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hwmon.h>
 #include <linux/i2c.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/pm_runtime.h>
 #include <linux/regmap.h>
 #include <linux/regulator/consumer.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
 #include <linux/videodev2.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
 
+#include <media/mipi-csi2.h>
 #include <media/v4l2-cci.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-subdev.h>
 
+#include "ar0822-embedded-data.h"
+
 #define AR0822_PIXEL_RATE 160000000
 #define AR0822_REG_ADDRESS_BITS 16
 
 #define AR0822_EMBEDDED_DATA_ENABLED
-#define AR0822_EMBEDDED_LINE_WIDTH 5760 // 3840 + padding bytes (every 3rd byte)
-#define AR0822_NUM_EMBEDDED_LINES 4
+
+/* Controls tracked in the debugfs statistics, more are not recorded */
+#define AR0822_CTRL_STATS_MAX 32
+
+/* Maximum number of register writes collected in a single batch */
+#define AR0822_WRITE_BATCH_MAX 32
+
+/* Row readout time limits of the line length */
+#define AR0822_LINE_LENGTH_PCK_MIN 792
+#define AR0822_LINE_LENGTH_PCK_MAX 0xFFFE // Line lengths are even
+/* HDR frame timing limits, exposures need at least this much blanking */
+#define AR0822_HDR_VBLANK_MIN 74
+#define AR0822_HDR_FRAME_PCK_MIN 3330288
 
 #define AR0822_VBLANK_STEP 1
 #define AR0822_FLL_MAX 0xFFFF // Maximum frame length lines register value
@@ -42,27 +66,66 @@
 #define AR0822_PIXEL_ARRAY_TOP 8
 #define AR0822_PIXEL_ARRAY_LEFT 8
 
+/* Crop alignment in sensor pixels, multiplied by binning for the size */
+#define AR0822_CROP_ALIGN 4
+#define AR0822_OUTPUT_MIN_WIDTH 64
+#define AR0822_OUTPUT_MIN_HEIGHT 64
+
 #define AR0822_EXPOSURE_MIN 1
 #define AR0822_EXPOSURE_STEP 1
 #define AR0822_EXPOSURE_MARGIN 4
 
-/*
- * Maximum exposure in HDR mode that respects T2+2*T3<=144 delay buffer rule.
- * Assuming default 16x integration time ratios.
- */
-#define AR0822_EXPOSURE_HDR_MAX 2048
+/* HDR delay buffer rows, T2+2*T3 must fit into it */
+#define AR0822_HDR_DELAY_BUFFER_ROWS 144
+
+/* EXPOSURE_RATIO fields hold log2 of the T1/T2 and T2/T3 ratios */
+#define AR0822_EXPOSURE_RATIO_T1_T2_SHIFT 0
+#define AR0822_EXPOSURE_RATIO_T2_T3_SHIFT 4
+#define AR0822_HDR_RATIO_DEFAULT 3 // 16x
 
 #define AR0822_ANA_GAIN_MIN 0
 #define AR0822_ANA_GAIN_MAX 119
 #define AR0822_ANA_GAIN_STEP 1
 #define AR0822_ANA_GAIN_DEFAULT 0
 
+/* Driver specific controls, outside the ranges reserved in videodev2.h */
+#define AR0822_CID_BASE (V4L2_CID_USER_BASE | 0x2000)
+#define AR0822_CID_FRAME_CTRLS (AR0822_CID_BASE + 0)
+#define AR0822_CID_FRAME_CTRL_DELAYS (AR0822_CID_BASE + 1)
+#define AR0822_CID_HDR_RATIO_T1_T2 (AR0822_CID_BASE + 2)
+#define AR0822_CID_HDR_RATIO_T2_T3 (AR0822_CID_BASE + 3)
+#define AR0822_CID_EXPOSURE_T2 (AR0822_CID_BASE + 4)
+#define AR0822_CID_EXPOSURE_T3 (AR0822_CID_BASE + 5)
+#define AR0822_CID_EMBEDDED_DATA (AR0822_CID_BASE + 6)
+#define AR0822_CID_FRAME_COUNT (AR0822_CID_BASE + 7)
+
+/* Per-frame control queue, see ar0822_fctl_work() */
+#define AR0822_FCTL_QUEUE_LEN 16
+#define AR0822_FCTL_KEEP U32_MAX // Leave the setting unchanged
+/* Frame periods without a new frame before the frame counter polling stops */
+#define AR0822_FCTL_STALL_FRAMES 8
+#define AR0822_FRAME_SYNC_EVENTS 4 // Events kept per subscriber
+
+/* Temperature readings are cached for this long, see ar0822_hwmon_read() */
+#define AR0822_TEMP_CACHE_MS 1000
+
 #define AR0822_MODEL_ID 0x0F56
 #define AR0822_REVISION_MIN 0x2303
 
 #define AR0822_MODE_SELECT_STREAM_OFF 0x00
 #define AR0822_MODE_SELECT_STREAM_ON BIT(0)
 
+#define AR0822_FLASH_ENABLE BIT(8)
+
+#define AR0822_GROUPED_PARAMETER_HOLD_OFF 0x00
+#define AR0822_GROUPED_PARAMETER_HOLD_ON BIT(0)
+
+#define AR0822_SMIA_TEST_EMBEDDED_STATS BIT(7)
+#define AR0822_SMIA_TEST_EMBEDDED_DATA BIT(8)
+
+#define AR0822_READ_MODE_4_EMBEDDED_ROWS BIT(2)
+#define AR0822_READ_MODE_BINNING 0x3000
+
 #define AR0822_IMAGE_ORIENTATION_HFLIP_BIT 0
 #define AR0822_IMAGE_ORIENTATION_VFLIP_BIT 1
 
@@ -93,14 +156,17 @@
 #define AR0822_REG_RESET CCI_REG16(0x301A)
 #define AR0822_REG_MODE_SELECT CCI_REG8(0x301C)
 #define AR0822_REG_IMAGE_ORIENTATION CCI_REG8(0x301D)
+#define AR0822_REG_GROUPED_PARAMETER_HOLD CCI_REG8(0x3022)
 #define AR0822_REG_VT_PIX_CLK_DIV CCI_REG16(0x302A)
 #define AR0822_REG_VT_SYS_CLK_DIV CCI_REG16(0x302C)
 #define AR0822_REG_PRE_PLL_CLK_DIV CCI_REG16(0x302E)
 #define AR0822_REG_PLL_MULTIPLIER CCI_REG16(0x3030)
 #define AR0822_REG_OP_WORD_CLK_DIV CCI_REG16(0x3036)
 #define AR0822_REG_OP_SYS_CLK_DIV CCI_REG16(0x3038)
+#define AR0822_REG_FRAME_COUNT CCI_REG16(0x303A)
 #define AR0822_REG_READ_MODE CCI_REG16(0x3040)
 #define AR0822_REG_DARK_CONTROL CCI_REG16(0x3044)
+#define AR0822_REG_FLASH CCI_REG16(0x3046)
 #define AR0822_REG_SMIA_TEST CCI_REG16(0x3064)
 #define AR0822_REG_TEST_PATTERN_MODE CCI_REG16(0x3070)
 #define AR0822_REG_TEST_DATA_RED CCI_REG16(0x3072)
@@ -111,8 +177,11 @@
 #define AR0822_REG_X_ODD_INC CCI_REG16(0x30A2)
 #define AR0822_REG_Y_ODD_INC CCI_REG16(0x30A6)
 #define AR0822_REG_DIGITAL_TEST CCI_REG16(0x30B0)
+#define AR0822_REG_TEMPSENS1_DATA_REG CCI_REG16(0x30B2)
 #define AR0822_REG_TEMPSENS1_CTRL_REG CCI_REG16(0x30B8)
 #define AR0822_REG_DIGITAL_CTRL CCI_REG16(0x30BA)
+#define AR0822_REG_TEMPSENS1_CALIB1 CCI_REG16(0x30C6)
+#define AR0822_REG_TEMPSENS1_CALIB2 CCI_REG16(0x30C8)
 #define AR0822_REG_HDR_CONTROL0 CCI_REG16(0x3110)
 #define AR0822_REG_HDR_CONTROL3 CCI_REG16(0x3116)
 #define AR0822_REG_SERIAL_FORMAT CCI_REG16(0x31AE)
@@ -190,6 +259,27 @@
 #define AR0822_REG_SENSOR_GAIN_TABLE_SEL CCI_REG16(0x5914)
 #define AR0822_REG_MIPI_PER_DESKEW_PAT_WIDTH CCI_REG16(0x5930)
 
+static int autosuspend_delay_ms = 1000;
+module_param(autosuspend_delay_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_delay_ms,
+		 "Runtime PM autosuspend delay in ms, negative never suspends");
+
+static bool keep_warm;
+module_param(keep_warm, bool, 0644);
+MODULE_PARM_DESC(keep_warm,
+		 "Keep the sensor powered in software standby when idle");
+
+/* Not documented for the AR0822, see AR0822_TEMPSENS_CALIB1_MILLIC */
+static int temp_calib1_millic = AR0822_TEMPSENS_CALIB1_MILLIC;
+module_param(temp_calib1_millic, int, 0644);
+MODULE_PARM_DESC(temp_calib1_millic,
+		 "Temperature of the TEMPSENS1_CALIB1 reading in millidegrees C");
+
+static int temp_calib2_millic = AR0822_TEMPSENS_CALIB2_MILLIC;
+module_param(temp_calib2_millic, int, 0644);
+MODULE_PARM_DESC(temp_calib2_millic,
+		 "Temperature of the TEMPSENS1_CALIB2 reading in millidegrees C");
+
 /* Helper macro for declaring ar0822 reg sequence */
 #define AR0822_REG_SEQ(_reg_array)                \
 	{                                         \
@@ -219,15 +309,43 @@ struct ar0822_reg_sequence {
 	struct cci_reg_sequence const *regs;
 };
 
+/* Run of registers at consecutive addresses, written in one transfer */
+struct ar0822_reg_burst {
+	u16 addr;
+	u16 len; /* bytes */
+	unsigned int offset; /* into the packed data */
+	unsigned int first; /* index of the first register in the table */
+	unsigned int amount;
+};
+
+/* Register table packed into bursts at probe time */
+struct ar0822_packed_seq {
+	struct ar0822_reg_sequence const *seq;
+	unsigned int bursts_amount;
+	struct ar0822_reg_burst *bursts;
+	u8 *data; /* big endian register values in table order */
+	/* Entries written again later in the same table */
+	unsigned long *superseded;
+};
+
 struct ar0822_format {
 	unsigned int width;
 	unsigned int height;
+	/* Rows output in HDR mode besides the image and embedded data */
+	unsigned int hdr_extra_rows;
+	/* Default crop, its size over the format size gives the binning */
 	struct v4l2_rect crop;
+	/* Only every row_skip-th row is read out, 0 if rows are not skipped */
+	unsigned int row_skip;
+	/* READ_MODE without the embedded data rows */
+	u16 read_mode;
 
+	/*
+	 * Validated limits at the default crop, they take precedence over
+	 * the timing model where set. Only 12bit HDR is supported.
+	 */
 	struct ar0822_timing timing_no_hdr[AR0822_LANE_MODE_ID_AMOUNT]
 					  [AR0822_BIT_DEPTH_ID_AMOUNT];
-
-	/* Only 12bit companded HDR mode currently supported. */
 	struct ar0822_timing timing_hdr[AR0822_LANE_MODE_ID_AMOUNT];
 
 	struct ar0822_reg_sequence reg_sequence;
@@ -243,6 +361,14 @@ struct ar0822_pll_config {
 
 	struct ar0822_reg_sequence regs_pll;
 	struct ar0822_reg_sequence regs_mipi[AR0822_BIT_DEPTH_ID_AMOUNT];
+
+	/* Timing model parameters, see ar0822_get_timing() */
+	unsigned int line_overhead[AR0822_BIT_DEPTH_ID_AMOUNT];
+	unsigned int line_length_pck_hdr_min;
+	/* Excluding embedded data lines */
+	unsigned int vblank_min;
+	/* Minimum frame length in pixel clocks for the full array height */
+	unsigned int frame_pck_min;
 };
 
 static const char *const ar0822_supply_names[] = {
@@ -261,10 +387,115 @@ struct ar0822_hw_config {
 	enum ar0822_lane_mode_id lane_mode;
 };
 
+enum ar0822_embedded_data {
+	AR0822_EMBEDDED_DATA_OFF = 0,
+	AR0822_EMBEDDED_DATA_REGS,
+	AR0822_EMBEDDED_DATA_REGS_STATS,
+};
+
+#ifdef AR0822_EMBEDDED_DATA_ENABLED
+#define AR0822_EMBEDDED_DATA_DEFAULT AR0822_EMBEDDED_DATA_REGS_STATS
+#else
+#define AR0822_EMBEDDED_DATA_DEFAULT AR0822_EMBEDDED_DATA_OFF
+#endif // AR0822_EMBEDDED_DATA_ENABLED
+
+static const char *const ar0822_embedded_data_menu[] = {
+	[AR0822_EMBEDDED_DATA_OFF] = "Disabled",
+	[AR0822_EMBEDDED_DATA_REGS] = "Registers",
+	[AR0822_EMBEDDED_DATA_REGS_STATS] = "Registers and Statistics",
+};
+
+static const u8 ar0822_embedded_data_lines[] = {
+	[AR0822_EMBEDDED_DATA_OFF] = 0,
+	[AR0822_EMBEDDED_DATA_REGS] = AR0822_EMBEDDED_REG_LINES,
+	[AR0822_EMBEDDED_DATA_REGS_STATS] =
+		AR0822_EMBEDDED_REG_LINES + AR0822_EMBEDDED_STATS_LINES,
+};
+
+static const u16 ar0822_embedded_data_smia_test[] = {
+	[AR0822_EMBEDDED_DATA_OFF] = 0,
+	[AR0822_EMBEDDED_DATA_REGS] = AR0822_SMIA_TEST_EMBEDDED_DATA,
+	[AR0822_EMBEDDED_DATA_REGS_STATS] = AR0822_SMIA_TEST_EMBEDDED_DATA |
+					    AR0822_SMIA_TEST_EMBEDDED_STATS,
+};
+
+/* The statistics take the two rows on top of the register rows */
+static const u16 ar0822_embedded_data_read_mode[] = {
+	[AR0822_EMBEDDED_DATA_OFF] = 0,
+	[AR0822_EMBEDDED_DATA_REGS] = 0,
+	[AR0822_EMBEDDED_DATA_REGS_STATS] = AR0822_READ_MODE_4_EMBEDDED_ROWS,
+};
+
 struct ar0822_mode {
 	struct ar0822_format const *format;
+	/* Active window, and the output size it results in */
+	struct v4l2_rect crop;
+	unsigned int width;
+	unsigned int height;
 	enum ar0822_bit_depth_id bit_depth;
 	bool hdr;
+	enum ar0822_embedded_data embedded_data;
+};
+
+enum ar0822_fctl_id {
+	AR0822_FCTL_EXPOSURE = 0,
+	AR0822_FCTL_GAIN,
+	AR0822_FCTL_VBLANK,
+	AR0822_FCTL_AMOUNT,
+};
+
+/*
+ * Frames between the frame a setting is written in and the first frame it
+ * affects. Settings latch at the next frame start, the integration of that
+ * frame has already started by then.
+ */
+static const u8 ar0822_fctl_delays[AR0822_FCTL_AMOUNT] = {
+	[AR0822_FCTL_EXPOSURE] = 2,
+	[AR0822_FCTL_GAIN] = 1,
+	[AR0822_FCTL_VBLANK] = 2,
+};
+
+/* Settings queued for one frame, see AR0822_CID_FRAME_CTRLS */
+struct ar0822_frame_ctrls {
+	u32 sequence;
+	u32 val[AR0822_FCTL_AMOUNT];
+	/* Bitmask of enum ar0822_fctl_id settings not written yet */
+	unsigned long pending;
+};
+
+/* Stream start stages timed in the debugfs statistics */
+enum ar0822_stat_id {
+	AR0822_STAT_POWER_ON = 0,
+	AR0822_STAT_CONFIG_MODE,
+	AR0822_STAT_CONFIG_WINDOW,
+	AR0822_STAT_CTRL_SETUP,
+	AR0822_STAT_STREAM_ON,
+	AR0822_STAT_START_STREAMING,
+	AR0822_STAT_AMOUNT,
+};
+
+static const char *const ar0822_stat_names[AR0822_STAT_AMOUNT] = {
+	[AR0822_STAT_POWER_ON] = "power_on",
+	[AR0822_STAT_CONFIG_MODE] = "config_mode",
+	[AR0822_STAT_CONFIG_WINDOW] = "config_window",
+	[AR0822_STAT_CTRL_SETUP] = "ctrl_setup",
+	[AR0822_STAT_STREAM_ON] = "stream_on",
+	[AR0822_STAT_START_STREAMING] = "start_streaming",
+};
+
+struct ar0822_stat {
+	u64 count;
+	u64 last_ns;
+	u64 total_ns;
+	u64 max_ns;
+	/* I2C transfers issued */
+	u64 transfers;
+};
+
+/* Start of a timed section, see ar0822_stat_end() */
+struct ar0822_stat_mark {
+	u64 ns;
+	s64 transfers;
 };
 
 enum pad_types {
@@ -282,6 +513,12 @@ struct ar0822 {
 
 	struct regmap *regmap;
 
+	/* Register values written since the sensor was last powered on */
+	struct xarray reg_shadow;
+	/* Static setup written since power on, and its HDR state */
+	bool static_init_done;
+	bool static_init_hdr;
+
 	struct v4l2_subdev subdev;
 	struct media_pad pad[NUM_PADS];
 
@@ -290,13 +527,91 @@ struct ar0822 {
 	struct v4l2_ctrl *hblank;
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vflip;
-	struct v4l2_ctrl *exposure;
+	struct {
+		/* Exposure and gain are set together as a cluster */
+		struct v4l2_ctrl *exposure;
+		struct v4l2_ctrl *gain;
+	};
 	struct v4l2_ctrl *hdr_mode;
+	struct v4l2_ctrl *hdr_ratio_t1_t2;
+	struct v4l2_ctrl *hdr_ratio_t2_t3;
+	struct v4l2_ctrl *embedded_data;
+	struct v4l2_ctrl *frame_ctrls;
+	struct v4l2_ctrl *flash_led_mode;
 
 	struct mutex mutex;
 	bool streaming;
+	unsigned int hold_depth;
+
+	/*
+	 * Grouped parameter hold taken by a control batch, released by
+	 * ar0822_ctrl_hold_work() once the batch drops the mutex
+	 */
+	struct {
+		struct work_struct work;
+		bool held;
+	} ctrl_hold;
+
+	/* Register writes deferred until the end of a batch */
+	struct {
+		unsigned int depth;
+		unsigned int amount;
+		int err;
+		struct cci_reg_sequence regs[AR0822_WRITE_BATCH_MAX];
+		u8 buf[AR0822_WRITE_BATCH_MAX * sizeof(u16)];
+	} batch;
+
+	/* Flattened mode setup, see ar0822_blob_index() */
+	struct ar0822_packed_seq *blobs;
+
+	/* Per-frame control queue, protected by the mutex */
+	struct {
+		struct delayed_work work;
+		struct ar0822_frame_ctrls queue[AR0822_FCTL_QUEUE_LEN];
+		unsigned int head;
+		unsigned int amount;
+		/* Sequence of the frame being output, -1 before the first one */
+		s64 sequence;
+		u16 frame_count;
+		/* Polls in a row that found no new frame */
+		unsigned int stalled;
+	} fctl;
+
+	/* Timing statistics, exposed in debugfs */
+	struct {
+		spinlock_t lock;
+		atomic64_t transfers;
+		struct ar0822_stat stages[AR0822_STAT_AMOUNT];
+		struct {
+			u32 id;
+			const char *name;
+			struct ar0822_stat stat;
+		} ctrls[AR0822_CTRL_STATS_MAX];
+		struct dentry *debugfs;
+	} stats;
+
+	/* Runtime suspended, but kept powered with registers retained */
+	bool standby;
+
 	struct ar0822_mode mode;
 	unsigned int fmt_code;
+
+	/* Requested by set_frame_interval, 0/0 for the minimum interval */
+	struct v4l2_fract frame_interval;
+	/* VBLANK was last set by userspace and is kept over mode changes */
+	bool vblank_user;
+	/* Set while the driver updates VBLANK itself, see ar0822_set_ctrl() */
+	bool vblank_derived;
+
+	/* Unregistered in remove, before the mutex it uses is destroyed */
+	struct device *hwmon;
+
+	/* Last temperature reading, protected by the mutex */
+	struct {
+		bool valid;
+		unsigned long updated;
+		s32 millic;
+	} temp;
 };
 
 enum ar0822_extclk_link_id {
@@ -319,6 +634,12 @@ static const u32 ar0822_format_codes[AR0822_BIT_DEPTH_ID_AMOUNT] = {
 	[AR0822_BIT_DEPTH_ID_12BIT] = MEDIA_BUS_FMT_SGRBG12_1X12,
 };
 
+/* Pixel data types, the low byte of AR0822_REG_MIPI_F1_PDT */
+static const u8 ar0822_csi2_data_types[AR0822_BIT_DEPTH_ID_AMOUNT] = {
+	[AR0822_BIT_DEPTH_ID_10BIT] = MIPI_CSI2_DT_RAW10,
+	[AR0822_BIT_DEPTH_ID_12BIT] = MIPI_CSI2_DT_RAW12,
+};
+
 static const struct cci_reg_sequence ar0822_pll_config_24_480[] = {
 	{ AR0822_REG_PLL_MULTIPLIER, 0x0050 },
 	{ AR0822_REG_PRE_PLL_CLK_DIV, 0x0001 },
@@ -335,34 +656,35 @@ static const struct cci_reg_sequence ar0822_pll_config_24_960[] = {
 	{ AR0822_REG_OP_SYS_CLK_DIV, 0x0002 },
 };
 
+/*
+ * Window and output size are programmed separately from the crop, READ_MODE
+ * together with the window, see ar0822_config_window()
+ */
 static const struct cci_reg_sequence ar0822_1080p_config[] = {
-	{ AR0822_REG_X_ADDR_START, 8 },
-	{ AR0822_REG_X_ADDR_END, 3847 },
-	{ AR0822_REG_Y_ADDR_START, 8 },
-	{ AR0822_REG_Y_ADDR_END, 2167 },
 	{ AR0822_REG_X_ODD_INC, 0x0003 },
 	{ AR0822_REG_Y_ODD_INC, 0x0003 },
-	{ AR0822_REG_X_OUTPUT_CONTROL, 1920 },
-	{ AR0822_REG_Y_OUTPUT_CONTROL, 1080 },
-	{ AR0822_REG_READ_MODE, 0x3004 }, // binning & 4 embedded data rows
+};
+
+static const struct cci_reg_sequence ar0822_540p_skip_config[] = {
+	{ AR0822_REG_X_ODD_INC, 0x0007 }, // 4x column skip
+	{ AR0822_REG_Y_ODD_INC, 0x0007 }, // 4x row skip
+};
+
+static const struct cci_reg_sequence ar0822_1080_row_skip_config[] = {
+	{ AR0822_REG_X_ODD_INC, 0x0001 }, // default no skip
+	{ AR0822_REG_Y_ODD_INC, 0x0003 }, // 2x row skip
 };
 
 static const struct cci_reg_sequence ar0822_4k_config[] = {
-	{ AR0822_REG_X_ADDR_START, 8 },
-	{ AR0822_REG_X_ADDR_END, 3847 },
-	{ AR0822_REG_Y_ADDR_START, 8 },
-	{ AR0822_REG_Y_ADDR_END, 2167 },
 	{ AR0822_REG_X_ODD_INC, 0x0001 }, // default no skip
 	{ AR0822_REG_Y_ODD_INC, 0x0001 }, // default no skip
-	{ AR0822_REG_X_OUTPUT_CONTROL, 3840 },
-	{ AR0822_REG_Y_OUTPUT_CONTROL, 2160 },
-	{ AR0822_REG_READ_MODE, 0x0004 }, // 4 embedded data rows
 };
 
 static const struct ar0822_format ar0822_formats_24_480[] = {
 	{
 		.width = 1920,
 		.height = 1080,
+		.hdr_extra_rows = 8,
 		.crop = {
 			.top = AR0822_PIXEL_ARRAY_TOP,
 			.left = AR0822_PIXEL_ARRAY_LEFT,
@@ -397,11 +719,13 @@ static const struct ar0822_format ar0822_formats_24_480[] = {
 				.frame_length_lines_min = 1404,
 			},
 		},
+		.read_mode = AR0822_READ_MODE_BINNING,
 		.reg_sequence = AR0822_REG_SEQ(ar0822_1080p_config),
 	},
 	{
 		.width = 3840,
 		.height = 2160,
+		.hdr_extra_rows = 10,
 		.crop = {
 			.top = AR0822_PIXEL_ARRAY_TOP,
 			.left = AR0822_PIXEL_ARRAY_LEFT,
@@ -438,12 +762,39 @@ static const struct ar0822_format ar0822_formats_24_480[] = {
 		},
 		.reg_sequence = AR0822_REG_SEQ(ar0822_4k_config),
 	},
+	{
+		.width = 960,
+		.height = 540,
+		.hdr_extra_rows = 8,
+		.crop = {
+			.top = AR0822_PIXEL_ARRAY_TOP,
+			.left = AR0822_PIXEL_ARRAY_LEFT,
+			.width = 3840,
+			.height = 2160,
+		},
+		.row_skip = 4,
+		.reg_sequence = AR0822_REG_SEQ(ar0822_540p_skip_config),
+	},
+	{
+		.width = 3840,
+		.height = 1080,
+		.hdr_extra_rows = 8,
+		.crop = {
+			.top = AR0822_PIXEL_ARRAY_TOP,
+			.left = AR0822_PIXEL_ARRAY_LEFT,
+			.width = 3840,
+			.height = 2160,
+		},
+		.row_skip = 2,
+		.reg_sequence = AR0822_REG_SEQ(ar0822_1080_row_skip_config),
+	},
 };
 
 static const struct ar0822_format ar0822_formats_24_960[] = {
 	{
 		.width = 1920,
 		.height = 1080,
+		.hdr_extra_rows = 8,
 		.crop = {
 			.top = AR0822_PIXEL_ARRAY_TOP,
 			.left = AR0822_PIXEL_ARRAY_LEFT,
@@ -468,21 +819,13 @@ static const struct ar0822_format ar0822_formats_24_960[] = {
 				.frame_length_lines_min = 3360,
 			},
 		},
-		.timing_hdr = {
-			[AR0822_LANE_MODE_ID_2] = { //todo
-				.line_length_pck_min = 2376,
-				.frame_length_lines_min = 2296,
-			},
-			[AR0822_LANE_MODE_ID_4] = {
-				.line_length_pck_min = 792, //todo
-				.frame_length_lines_min = 3360, //todo
-			},
-		},
+		.read_mode = AR0822_READ_MODE_BINNING,
 		.reg_sequence = AR0822_REG_SEQ(ar0822_1080p_config),
 	},
 	{
 		.width = 3840,
 		.height = 2160,
+		.hdr_extra_rows = 10,
 		.crop = {
 			.top = AR0822_PIXEL_ARRAY_TOP,
 			.left = AR0822_PIXEL_ARRAY_LEFT,
@@ -507,18 +850,34 @@ static const struct ar0822_format ar0822_formats_24_960[] = {
 				.frame_length_lines_min = 2288,
 			},
 		},
-		.timing_hdr = {
-			[AR0822_LANE_MODE_ID_2] = { // todo
-				.line_length_pck_min = 2376,
-				.frame_length_lines_min = 2296,
-			},
-			[AR0822_LANE_MODE_ID_4] = { // todo
-				.line_length_pck_min = 2372,
-				.frame_length_lines_min = 2248,
-			},
-		},
 		.reg_sequence = AR0822_REG_SEQ(ar0822_4k_config),
 	},
+	{
+		.width = 960,
+		.height = 540,
+		.hdr_extra_rows = 8,
+		.crop = {
+			.top = AR0822_PIXEL_ARRAY_TOP,
+			.left = AR0822_PIXEL_ARRAY_LEFT,
+			.width = 3840,
+			.height = 2160,
+		},
+		.row_skip = 4,
+		.reg_sequence = AR0822_REG_SEQ(ar0822_540p_skip_config),
+	},
+	{
+		.width = 3840,
+		.height = 1080,
+		.hdr_extra_rows = 8,
+		.crop = {
+			.top = AR0822_PIXEL_ARRAY_TOP,
+			.left = AR0822_PIXEL_ARRAY_LEFT,
+			.width = 3840,
+			.height = 2160,
+		},
+		.row_skip = 2,
+		.reg_sequence = AR0822_REG_SEQ(ar0822_1080_row_skip_config),
+	},
 };
 
 static const struct cci_reg_sequence ar0822_mipi_timing_24_480_10bit[] = {
@@ -583,6 +942,13 @@ static const struct ar0822_pll_config ar0822_pll_configs[] = {
 			[AR0822_BIT_DEPTH_ID_10BIT] = AR0822_REG_SEQ(ar0822_mipi_timing_24_480_10bit),
 			[AR0822_BIT_DEPTH_ID_12BIT] = AR0822_REG_SEQ(ar0822_mipi_timing_24_480_12bit),
 		},
+		.line_overhead = {
+			[AR0822_BIT_DEPTH_ID_10BIT] = 212,
+			[AR0822_BIT_DEPTH_ID_12BIT] = 222,
+		},
+		.line_length_pck_hdr_min = 2372,
+		.vblank_min = 42,
+		.frame_pck_min = 1331792, // 120 fps
 	},
 	{
 		.freq_link =
@@ -597,6 +963,13 @@ static const struct ar0822_pll_config ar0822_pll_configs[] = {
 			[AR0822_BIT_DEPTH_ID_10BIT] = AR0822_REG_SEQ(ar0822_mipi_timing_24_960_10bit),
 			[AR0822_BIT_DEPTH_ID_12BIT] = AR0822_REG_SEQ(ar0822_mipi_timing_24_960_12bit),
 		},
+		.line_overhead = {
+			[AR0822_BIT_DEPTH_ID_10BIT] = 184,
+			[AR0822_BIT_DEPTH_ID_12BIT] = 186,
+		},
+		.line_length_pck_hdr_min = 2376,
+		.vblank_min = 20,
+		.frame_pck_min = 2661120, // 60 fps
 	},
 };
 
@@ -629,9 +1002,7 @@ static const struct cci_reg_sequence ar0822_regs_common[] = {
 	{ AR0822_REG_T1_NOISE_FLOOR3, 0x0004 },
 	{ AR0822_REG_PIX_DEF_ID, 0x0001 },
 	{ AR0822_REG_T1_PIX_DEF_ID, 0x11C1 },
-#ifdef AR0822_EMBEDDED_DATA_ENABLED
-	{ AR0822_REG_SMIA_TEST, 0x0100 }, // Enable embedded data
-#endif // AR0822_EMBEDDED_DATA_ENABLED
+	/* SMIA_TEST is set by the embedded data control */
 	{ AR0822_REG_OPERATION_MODE_CTRL, 0x0001 },
 	{ AR0822_REG_TEMPSENS1_CTRL_REG, 0x0011 }, // Enable temperature sensor
 	{ AR0822_REG_DIGITAL_CTRL, 0x0024 },
@@ -771,212 +1142,1198 @@ static const struct cci_reg_sequence ar0822_regs_hdr[] = {
 	{ AR0822_REG_COMPANDING, 0x0001 },
 	{ AR0822_REG_OPERATION_MODE_CTRL, 0x0008 }, // override common
 	{ AR0822_REG_DIGITAL_CTRL, 0x013E }, // override common
-	{ AR0822_REG_EXPOSURE_RATIO, 0x0044 }, // 16x
+	/* EXPOSURE_RATIO is set by the HDR ratio controls */
 	{ AR0822_REG_SENSOR_GAIN_TABLE_SEL, 0x4006 }, //select gain table 1
 };
 
+static const struct ar0822_reg_sequence ar0822_seq_common =
+	AR0822_REG_SEQ(ar0822_regs_common);
+static const struct ar0822_reg_sequence ar0822_seq_mfr_common =
+	AR0822_REG_SEQ(ar0822_regs_mfr_common);
+static const struct ar0822_reg_sequence ar0822_seq_mfr_hdr =
+	AR0822_REG_SEQ(ar0822_regs_mfr_hdr);
+static const struct ar0822_reg_sequence ar0822_seq_hdr =
+	AR0822_REG_SEQ(ar0822_regs_hdr);
+
 static inline struct ar0822 *to_ar0822(struct v4l2_subdev *sd)
 {
 	return container_of(sd, struct ar0822, subdev);
 }
 
-static void ar0822_adjust_exposure_range(struct ar0822 *sensor)
+static void ar0822_stat_begin(struct ar0822 *sensor,
+			      struct ar0822_stat_mark *mark)
 {
-	int exposure_max;
-	u32 frame_length_lines =
-		sensor->mode.format->height + sensor->vblank->val;
-
-	if (sensor->mode.hdr) {
-		/* 
-		 * Limit exposure range ensuring fixed FPS based on frame length lines.
-		 * Calculate sensor internal vblank (not v4l2) based on output rows.
-		 * With 4 embedded data rows enabled, output rows amount
-		 * is 2174 @ 4k and 1092 @ 1080p.
-		 * Following HDR exposure limit calculations assume that T1/T2 and 
-		 * T2/T3 ratios are at their default 16x settings. 
-		 */
-		u16 rows = (sensor->mode.format->height == 2160) ? 2174 : 1092;
-		u32 vblank = frame_length_lines - rows;
-		u32 fll_limit;
+	mark->ns = ktime_get_ns();
+	mark->transfers = atomic64_read(&sensor->stats.transfers);
+}
+
+static void ar0822_stat_record(struct ar0822 *sensor, struct ar0822_stat *stat,
+			       struct ar0822_stat_mark const *mark)
+{
+	u64 ns = ktime_get_ns() - mark->ns;
+
+	stat->count++;
+	stat->last_ns = ns;
+	stat->total_ns += ns;
+	stat->max_ns = max(stat->max_ns, ns);
+	stat->transfers +=
+		atomic64_read(&sensor->stats.transfers) - mark->transfers;
+}
+
+static void ar0822_stat_end(struct ar0822 *sensor, enum ar0822_stat_id id,
+			    struct ar0822_stat_mark const *mark)
+{
+	spin_lock(&sensor->stats.lock);
+	ar0822_stat_record(sensor, &sensor->stats.stages[id], mark);
+	spin_unlock(&sensor->stats.lock);
+}
 
-		/* Calculate exposure limit for T2+T3 <= vblank-28 */
-		exposure_max = ((vblank - 28) * 256) / 17;
+static void ar0822_stat_ctrl_end(struct ar0822 *sensor, struct v4l2_ctrl *ctrl,
+				 struct ar0822_stat_mark const *mark)
+{
+	unsigned int i;
 
-		/* Calculate exposure limit for T1+T2+T3+28 <= fll */
-		fll_limit = ((frame_length_lines - 28) * 256) / 273;
+	spin_lock(&sensor->stats.lock);
 
-		if (exposure_max > fll_limit)
-			exposure_max = fll_limit;
+	for (i = 0; i < AR0822_CTRL_STATS_MAX; i++) {
+		if (!sensor->stats.ctrls[i].name) {
+			sensor->stats.ctrls[i].id = ctrl->id;
+			sensor->stats.ctrls[i].name = ctrl->name;
+		}
 
-		/* Ensure delay buffers are not exceeded T2+2*T3 <= 144 */
-		if (exposure_max > AR0822_EXPOSURE_HDR_MAX)
-			exposure_max = AR0822_EXPOSURE_HDR_MAX;
-	} else {
-		exposure_max = frame_length_lines - AR0822_EXPOSURE_MARGIN;
+		if (sensor->stats.ctrls[i].id == ctrl->id) {
+			ar0822_stat_record(sensor, &sensor->stats.ctrls[i].stat,
+					   mark);
+			break;
+		}
 	}
 
-	__v4l2_ctrl_modify_range(sensor->exposure, sensor->exposure->minimum,
-				 exposure_max, sensor->exposure->step,
-				 exposure_max);
+	spin_unlock(&sensor->stats.lock);
 }
 
-static struct ar0822_timing const *ar0822_get_timing(struct ar0822 *sensor)
+static void ar0822_stat_show(struct seq_file *m, const char *name,
+			     struct ar0822_stat const *stat)
 {
-	if (sensor->mode.hdr) {
-		return &sensor->mode.format
-				->timing_hdr[sensor->hw_config.lane_mode];
-	}
-
-	return &sensor->mode.format->timing_no_hdr[sensor->hw_config.lane_mode]
-						  [sensor->mode.bit_depth];
+	seq_printf(m, "%-32s %8llu %10llu %10llu %10llu %10llu\n", name,
+		   stat->count, div_u64(stat->last_ns, NSEC_PER_USEC),
+		   stat->count ? div64_u64(stat->total_ns,
+					   stat->count * NSEC_PER_USEC) :
+				 0,
+		   div_u64(stat->max_ns, NSEC_PER_USEC), stat->transfers);
 }
 
-static void ar0822_set_framing_limits(struct ar0822 *sensor)
+static int ar0822_stats_show(struct seq_file *m, void *data)
 {
-	int hblank, vblank_min;
-	const struct ar0822_format *format = sensor->mode.format;
-	struct ar0822_timing const *timing = ar0822_get_timing(sensor);
+	struct ar0822 *sensor = m->private;
+	unsigned int i;
 
-	/* Update limits and set FPS to default */
-	vblank_min = timing->frame_length_lines_min - format->height;
-	__v4l2_ctrl_modify_range(sensor->vblank, vblank_min,
-				 AR0822_FLL_MAX - format->height,
-				 sensor->vblank->step, vblank_min);
+	seq_printf(m, "%-32s %8s %10s %10s %10s %10s\n", "name", "count",
+		   "last_us", "avg_us", "max_us", "transfers");
+
+	spin_lock(&sensor->stats.lock);
 
-	/* Setting this will adjust the exposure limits as well */
-	__v4l2_ctrl_s_ctrl(sensor->vblank, vblank_min);
+	for (i = 0; i < AR0822_STAT_AMOUNT; i++)
+		ar0822_stat_show(m, ar0822_stat_names[i],
+				 &sensor->stats.stages[i]);
 
-	hblank = timing->line_length_pck_min - format->width;
-	__v4l2_ctrl_modify_range(sensor->hblank, hblank, hblank, 1, hblank);
-	__v4l2_ctrl_s_ctrl(sensor->hblank, hblank);
+	for (i = 0; i < AR0822_CTRL_STATS_MAX && sensor->stats.ctrls[i].name;
+	     i++)
+		ar0822_stat_show(m, sensor->stats.ctrls[i].name,
+				 &sensor->stats.ctrls[i].stat);
+
+	spin_unlock(&sensor->stats.lock);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(ar0822_stats);
 
-static int ar0822_set_ctrl(struct v4l2_ctrl *ctrl)
+static bool ar0822_shadow_match(struct ar0822 *sensor, u32 reg, u64 val)
 {
-	struct ar0822 *sensor =
-		container_of(ctrl->handler, struct ar0822, ctrl_hdlr);
-	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
-	int ret = 0;
+	void *entry = xa_load(&sensor->reg_shadow, reg);
 
-	if (ctrl->id == V4L2_CID_VBLANK) {
-		ar0822_adjust_exposure_range(sensor);
-	} else if (ctrl->id == V4L2_CID_WIDE_DYNAMIC_RANGE) {
-		/*
-		 * The WIDE_DYNAMIC_RANGE control can also be applied immediately
-		 * as it doesn't set any registers. Don't do anything if the mode
-		 * already matches.
-		 */
-		if (sensor->mode.hdr != ctrl->val) {
-			dev_dbg(sensor->dev, "hdr %d\n", ctrl->val);
+	return entry && xa_to_value(entry) == val;
+}
 
-			sensor->mode.hdr = ctrl->val;
-			ar0822_set_framing_limits(sensor);
-		}
+static void ar0822_shadow_update(struct ar0822 *sensor, u32 reg, u64 val,
+				 int ret)
+{
+	if (ret) {
+		xa_erase(&sensor->reg_shadow, reg);
+		return;
 	}
 
-	/*
-	 * Applying V4L2 control value only happens
-	 * when power is up for streaming
-	 */
-	if (pm_runtime_get_if_in_use(&client->dev) == 0)
-		return 0;
+	/* Failing to record the value only costs a redundant write later */
+	xa_store(&sensor->reg_shadow, reg, xa_mk_value(val), GFP_KERNEL);
+}
 
-	switch (ctrl->id) {
-	case V4L2_CID_VBLANK:
-		dev_dbg(sensor->dev,
-			"ar0822_set_ctrl: AR0822_REG_FRAME_LENGTH_LINES %d\n",
-			sensor->mode.format->height + ctrl->val);
-		ret = cci_write(sensor->regmap, AR0822_REG_FRAME_LENGTH_LINES,
-				sensor->mode.format->height + ctrl->val, NULL);
-		break;
-	case V4L2_CID_EXPOSURE:
-		dev_dbg(sensor->dev,
-			"ar0822_set_ctrl: AR0822_REG_COARSE_INTEGRATION_TIME %d\n",
-			ctrl->val);
-		ret = cci_write(sensor->regmap,
-				AR0822_REG_COARSE_INTEGRATION_TIME, ctrl->val,
-				NULL);
-		break;
-	case V4L2_CID_ANALOGUE_GAIN:
-		dev_dbg(sensor->dev,
-			"ar0822_set_ctrl: AR0822_REG_SENSOR_GAIN %d\n",
-			ctrl->val);
-		ret = cci_write(sensor->regmap, AR0822_REG_SENSOR_GAIN,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_HFLIP:
-	case V4L2_CID_VFLIP:
+static int ar0822_batch_cmp(const void *a, const void *b)
+{
+	const struct cci_reg_sequence *ra = a, *rb = b;
 
-		dev_dbg(sensor->dev,
-			"ar0822_set_ctrl: AR0822_REG_IMAGE_ORIENTATION %d\n",
-			sensor->hflip->val | sensor->vflip->val << 1);
-		ret = cci_write(sensor->regmap, AR0822_REG_IMAGE_ORIENTATION,
-				sensor->hflip->val | sensor->vflip->val << 1,
-				NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN:
-		dev_dbg(sensor->dev, "AR0822_REG_TEST_PATTERN_MODE %d\n",
-			ar0822_test_pattern_val[ctrl->val]);
+	return CCI_REG_ADDR(ra->reg) - CCI_REG_ADDR(rb->reg);
+}
 
-		ret = cci_write(sensor->regmap, AR0822_REG_TEST_PATTERN_MODE,
-				ar0822_test_pattern_val[ctrl->val], NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_RED:
-		ret = cci_write(sensor->regmap, AR0822_REG_TEST_DATA_RED,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_GREENR:
-		ret = cci_write(sensor->regmap, AR0822_REG_TEST_DATA_GREENR,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_BLUE:
-		ret = cci_write(sensor->regmap, AR0822_REG_TEST_DATA_BLUE,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_GREENB:
-		ret = cci_write(sensor->regmap, AR0822_REG_TEST_DATA_GREENB,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_WIDE_DYNAMIC_RANGE:
-		/* Already handled above. */
-		break;
-	default:
-		dev_err(sensor->dev, "unhandled control %x\n", ctrl->id);
-		ret = -EINVAL;
-		break;
+/*
+ * Write out the collected batch. Writes are sorted by address and registers
+ * at consecutive addresses are merged into a single auto-increment transfer.
+ */
+static int ar0822_batch_flush(struct ar0822 *sensor)
+{
+	struct cci_reg_sequence *regs = sensor->batch.regs;
+	unsigned int amount = sensor->batch.amount;
+	unsigned int i, j;
+	int ret = sensor->batch.err;
+
+	sort(regs, amount, sizeof(*regs), ar0822_batch_cmp, NULL);
+
+	for (i = 0; i < amount && !ret; i = j) {
+		u32 addr = CCI_REG_ADDR(regs[i].reg);
+		unsigned int len = 0;
+
+		for (j = i; j < amount; j++) {
+			unsigned int width = CCI_REG_WIDTH_BYTES(regs[j].reg);
+
+			if (CCI_REG_ADDR(regs[j].reg) != addr + len ||
+			    len + width > sizeof(sensor->batch.buf))
+				break;
+
+			/* CCI registers are big endian */
+			for (unsigned int b = 0; b < width; b++)
+				sensor->batch.buf[len + b] =
+					regs[j].val >> (8 * (width - 1 - b));
+
+			len += width;
+		}
+
+		ret = regmap_bulk_write(sensor->regmap, addr, sensor->batch.buf,
+					len);
+		atomic64_inc(&sensor->stats.transfers);
+		if (ret)
+			dev_err(sensor->dev, "Error writing reg 0x%04x: %d\n",
+				addr, ret);
+
+		for (unsigned int k = i; k < j; k++)
+			ar0822_shadow_update(sensor, regs[k].reg, regs[k].val,
+					     ret);
 	}
 
-	pm_runtime_mark_last_busy(&client->dev);
-	pm_runtime_put_autosuspend(&client->dev);
+	/* Writes that were not attempted leave the shadow unknown */
+	for (; i < amount; i++)
+		xa_erase(&sensor->reg_shadow, regs[i].reg);
+
+	sensor->batch.amount = 0;
+	sensor->batch.err = 0;
 
 	return ret;
 }
 
-static const struct v4l2_ctrl_ops ar0822_ctrl_ops = {
-	.s_ctrl = ar0822_set_ctrl,
-};
-
-static int ar0822_ctrls_init(struct ar0822 *sensor)
+static int ar0822_batch_add(struct ar0822 *sensor, u32 reg, u64 val)
 {
-	struct v4l2_fwnode_device_properties props;
-	struct v4l2_ctrl *ctrl;
-	struct ar0822_timing const *timing = ar0822_get_timing(sensor);
-	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
-	u8 link_freq_id =
-		sensor->pll_config->freq_link - ar0822_link_frequencies;
-	u32 exposure_max;
+	unsigned int i;
 	int ret;
 
-	ret = v4l2_ctrl_handler_init(&sensor->ctrl_hdlr, 16);
-	if (ret)
-		return ret;
+	for (i = 0; i < sensor->batch.amount; i++) {
+		if (sensor->batch.regs[i].reg == reg) {
+			sensor->batch.regs[i].val = val;
+			return 0;
+		}
+	}
 
-	mutex_init(&sensor->mutex);
-	sensor->ctrl_hdlr.lock = &sensor->mutex;
+	if (ar0822_shadow_match(sensor, reg, val))
+		return 0;
 
-	/* Link frequency (read only) */
-	ctrl = v4l2_ctrl_new_int_menu(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
-				      V4L2_CID_LINK_FREQ,
+	if (sensor->batch.amount == AR0822_WRITE_BATCH_MAX) {
+		ret = ar0822_batch_flush(sensor);
+		if (ret) {
+			sensor->batch.err = ret;
+			return ret;
+		}
+	}
+
+	sensor->batch.regs[sensor->batch.amount].reg = reg;
+	sensor->batch.regs[sensor->batch.amount].val = val;
+	sensor->batch.amount++;
+
+	return 0;
+}
+
+/*
+ * Collect register writes until the matching ar0822_batch_end(). Batches
+ * nest, the outermost end writes everything out and reports the first error.
+ */
+static void ar0822_batch_begin(struct ar0822 *sensor)
+{
+	sensor->batch.depth++;
+}
+
+static int ar0822_batch_end(struct ar0822 *sensor)
+{
+	if (--sensor->batch.depth)
+		return 0;
+
+	return ar0822_batch_flush(sensor);
+}
+
+/*
+ * Write a register through the shadow cache. The write is skipped if the
+ * sensor already holds the requested value. The shadow is only valid while
+ * the sensor stays powered and is dropped in ar0822_power_off(). Inside a
+ * batch the write is deferred until the batch ends.
+ */
+static int ar0822_write(struct ar0822 *sensor, u32 reg, u64 val, int *err)
+{
+	int ret;
+
+	if (err && *err)
+		return *err;
+
+	if (sensor->batch.depth) {
+		ret = ar0822_batch_add(sensor, reg, val);
+		if (ret && err)
+			*err = ret;
+
+		return ret;
+	}
+
+	if (ar0822_shadow_match(sensor, reg, val))
+		return 0;
+
+	ret = cci_write(sensor->regmap, reg, val, err);
+	atomic64_inc(&sensor->stats.transfers);
+	ar0822_shadow_update(sensor, reg, val, ret);
+
+	return ret;
+}
+
+/*
+ * Read a register through the shadow cache, only for registers that nothing
+ * but the driver changes. The sensor is only read if the shadow doesn't hold
+ * the register, and the value read is recorded for later reads and writes.
+ */
+static int ar0822_read(struct ar0822 *sensor, u32 reg, u64 *val, int *err)
+{
+	void *entry;
+	int ret;
+
+	if (err && *err)
+		return *err;
+
+	entry = xa_load(&sensor->reg_shadow, reg);
+	if (entry) {
+		*val = xa_to_value(entry);
+		return 0;
+	}
+
+	ret = cci_read(sensor->regmap, reg, val, err);
+	atomic64_inc(&sensor->stats.transfers);
+	ar0822_shadow_update(sensor, reg, *val, ret);
+
+	return ret;
+}
+
+/*
+ * While the hold is set the sensor latches register writes internally and
+ * applies all of them together on the next frame boundary after release.
+ * Holds nest, only the outermost hold and release reach the sensor.
+ */
+static int ar0822_group_hold(struct ar0822 *sensor, bool hold)
+{
+	int ret;
+
+	if (hold ? sensor->hold_depth++ : --sensor->hold_depth)
+		return 0;
+
+	ret = cci_write(sensor->regmap, AR0822_REG_GROUPED_PARAMETER_HOLD,
+			hold ? AR0822_GROUPED_PARAMETER_HOLD_ON :
+			       AR0822_GROUPED_PARAMETER_HOLD_OFF,
+			NULL);
+	atomic64_inc(&sensor->stats.transfers);
+	if (ret && hold)
+		sensor->hold_depth = 0;
+
+	return ret;
+}
+
+/*
+ * A control batch such as S_EXT_CTRLS calls ar0822_set_ctrl() once per
+ * cluster with the mutex held for the whole batch. Take the grouped parameter
+ * hold on the first control and release it from a work item, which can only
+ * get the mutex after the batch is done, so all of its writes land on the same
+ * frame. The hold keeps a runtime PM reference until it is released.
+ */
+static void ar0822_ctrl_hold(struct ar0822 *sensor)
+{
+	if (sensor->ctrl_hold.held || ar0822_group_hold(sensor, true))
+		return;
+
+	sensor->ctrl_hold.held = true;
+	pm_runtime_get_noresume(sensor->dev);
+	queue_work(system_highpri_wq, &sensor->ctrl_hold.work);
+}
+
+static void ar0822_ctrl_hold_release(struct ar0822 *sensor)
+{
+	if (!sensor->ctrl_hold.held)
+		return;
+
+	sensor->ctrl_hold.held = false;
+	if (ar0822_group_hold(sensor, false))
+		dev_err(sensor->dev, "failed to release grouped parameter hold\n");
+
+	pm_runtime_mark_last_busy(sensor->dev);
+	pm_runtime_put_autosuspend(sensor->dev);
+}
+
+static void ar0822_ctrl_hold_work(struct work_struct *work)
+{
+	struct ar0822 *sensor =
+		container_of(work, struct ar0822, ctrl_hold.work);
+
+	mutex_lock(&sensor->mutex);
+	ar0822_ctrl_hold_release(sensor);
+	mutex_unlock(&sensor->mutex);
+}
+
+static u16 ar0822_read_mode_val(struct ar0822 *sensor)
+{
+	return sensor->mode.format->read_mode |
+	       ar0822_embedded_data_read_mode[sensor->mode.embedded_data];
+}
+
+/* HDR exposure ratio menu, the register holds log2 of the ratio */
+static const s64 ar0822_hdr_ratios[] = { 2, 4, 8, 16 };
+
+static u16 ar0822_exposure_ratio_val(struct ar0822 *sensor)
+{
+	return (sensor->hdr_ratio_t1_t2->val + 1)
+		       << AR0822_EXPOSURE_RATIO_T1_T2_SHIFT |
+	       (sensor->hdr_ratio_t2_t3->val + 1)
+		       << AR0822_EXPOSURE_RATIO_T2_T3_SHIFT;
+}
+
+/*
+ * Longest T1 exposure in HDR mode for a frame of frame_length_lines, of
+ * which rows are output. With r1 = T1/T2 and r2 = T2/T3, T2 = T1/r1 and
+ * T3 = T1/(r1*r2).
+ */
+static u32 ar0822_hdr_exposure_max(u32 frame_length_lines, u32 rows, u32 r1,
+				   u32 r2)
+{
+	u32 vblank = frame_length_lines - rows;
+	u32 exposure_max, fll_limit, buffer_limit;
+
+	/* Calculate exposure limit for T2+T3 <= vblank-28 */
+	exposure_max = ((vblank - 28) * r1 * r2) / (r2 + 1);
+
+	/* Calculate exposure limit for T1+T2+T3+28 <= fll */
+	fll_limit = ((frame_length_lines - 28) * r1 * r2) / (r1 * r2 + r2 + 1);
+
+	if (exposure_max > fll_limit)
+		exposure_max = fll_limit;
+
+	/* Ensure delay buffers are not exceeded T2+2*T3 <= 144 */
+	buffer_limit = (AR0822_HDR_DELAY_BUFFER_ROWS * r1 * r2) / (r2 + 2);
+	if (exposure_max > buffer_limit)
+		exposure_max = buffer_limit;
+
+	return exposure_max;
+}
+
+static u32 ar0822_exposure_max(struct ar0822 *sensor, u32 frame_length_lines)
+{
+	u16 rows;
+
+	if (!sensor->mode.hdr)
+		return frame_length_lines - AR0822_EXPOSURE_MARGIN;
+
+	/*
+	 * Limit exposure range ensuring fixed FPS based on frame length lines.
+	 * Calculate sensor internal vblank (not v4l2) based on output rows.
+	 * With 4 embedded data rows enabled, output rows amount
+	 * is 2174 @ 4k and 1092 @ 1080p, the extra rows come from the
+	 * format and the embedded data lines.
+	 */
+	rows = sensor->mode.height + sensor->mode.format->hdr_extra_rows +
+	       ar0822_embedded_data_lines[sensor->mode.embedded_data];
+
+	return ar0822_hdr_exposure_max(
+		frame_length_lines, rows,
+		ar0822_hdr_ratios[sensor->hdr_ratio_t1_t2->val],
+		ar0822_hdr_ratios[sensor->hdr_ratio_t2_t3->val]);
+}
+
+static void ar0822_adjust_exposure_range(struct ar0822 *sensor)
+{
+	int exposure_max = ar0822_exposure_max(
+		sensor, sensor->mode.height + sensor->vblank->val);
+
+	__v4l2_ctrl_modify_range(sensor->exposure, sensor->exposure->minimum,
+				 exposure_max, sensor->exposure->step,
+				 exposure_max);
+}
+
+static int ar0822_get_bit_depth(enum ar0822_bit_depth_id id, u8 *bit_depth)
+{
+	if (!bit_depth)
+		return -EINVAL;
+
+	switch (id) {
+	case AR0822_BIT_DEPTH_ID_10BIT:
+		*bit_depth = 10;
+		break;
+	case AR0822_BIT_DEPTH_ID_12BIT:
+		*bit_depth = 12;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Derive the minimum line and frame length of the current mode. A line
+ * takes the time needed to send it over the CSI-2 link plus a fixed
+ * overhead, but no less than the row readout time. A frame is the output
+ * rows plus the minimum vertical blanking, but no shorter than the time
+ * needed to read out the rows of the crop window.
+ *
+ * The validated limits of the format are used instead at its default crop
+ * size, they are kept even if a longer line would allow a shorter frame.
+ */
+static void ar0822_get_timing(struct ar0822 *sensor,
+			      struct ar0822_timing *timing)
+{
+	struct ar0822_pll_config const *pll_config = sensor->pll_config;
+	struct ar0822_mode const *mode = &sensor->mode;
+	enum ar0822_lane_mode_id lane_mode = sensor->hw_config.lane_mode;
+	enum ar0822_bit_depth_id bit_depth = mode->bit_depth;
+	struct ar0822_timing const *validated;
+	unsigned int line_length_pck_min = AR0822_LINE_LENGTH_PCK_MIN;
+	unsigned int embedded_lines =
+		ar0822_embedded_data_lines[mode->embedded_data];
+	unsigned int rows = mode->height + embedded_lines +
+			    pll_config->vblank_min;
+	u64 frame_pck_min = pll_config->frame_pck_min;
+	u64 link_rate;
+	u32 llpck;
+	u8 bpp = 12;
+
+	if (mode->hdr)
+		validated = &mode->format->timing_hdr[lane_mode];
+	else
+		validated = &mode->format->timing_no_hdr[lane_mode][bit_depth];
+
+	if (validated->line_length_pck_min &&
+	    mode->crop.width == mode->format->crop.width &&
+	    mode->crop.height == mode->format->crop.height) {
+		*timing = *validated;
+		return;
+	}
+
+	/* Only 12bit companded HDR mode currently supported. */
+	if (mode->hdr) {
+		bit_depth = AR0822_BIT_DEPTH_ID_12BIT;
+		line_length_pck_min = pll_config->line_length_pck_hdr_min;
+		rows = mode->height + mode->format->hdr_extra_rows +
+		       embedded_lines + AR0822_HDR_VBLANK_MIN;
+		frame_pck_min = AR0822_HDR_FRAME_PCK_MIN;
+	}
+
+	ar0822_get_bit_depth(bit_depth, &bpp);
+
+	/* Lanes are double data rate, two bits per link clock */
+	link_rate = 2 * *pll_config->freq_link *
+		    sensor->hw_config.num_data_lanes;
+
+	llpck = DIV64_U64_ROUND_UP((u64)mode->width * bpp *
+					   pll_config->pixel_rate,
+				   link_rate) +
+		pll_config->line_overhead[bit_depth];
+	llpck = ALIGN(max(llpck, line_length_pck_min), 2);
+
+	/* The rows read out scale with the crop window height and skipping */
+	frame_pck_min = div_u64(frame_pck_min * mode->crop.height,
+				AR0822_PIXEL_ARRAY_HEIGHT);
+	if (mode->format->row_skip)
+		frame_pck_min = div_u64(frame_pck_min, mode->format->row_skip);
+
+	timing->line_length_pck_min = llpck;
+
+	/* Less lines are needed for the row readout if they are made longer */
+	if (sensor->hblank)
+		llpck = max_t(u32, llpck, mode->width + sensor->hblank->val);
+
+	timing->frame_length_lines_min =
+		max_t(u32, rows, DIV_ROUND_UP_ULL(frame_pck_min, llpck));
+}
+
+/* Update the VBLANK limits to the current line length */
+static void ar0822_adjust_vblank_range(struct ar0822 *sensor)
+{
+	struct ar0822_timing timing;
+	int vblank_min;
+
+	ar0822_get_timing(sensor, &timing);
+
+	vblank_min = timing.frame_length_lines_min - sensor->mode.height;
+
+	sensor->vblank_derived = true;
+	__v4l2_ctrl_modify_range(sensor->vblank, vblank_min,
+				 AR0822_FLL_MAX - sensor->mode.height,
+				 sensor->vblank->step, vblank_min);
+	sensor->vblank_derived = false;
+}
+
+/* Frame interval of a frame length at the current line length */
+static void ar0822_get_interval(struct ar0822 *sensor, u32 frame_length,
+				struct v4l2_fract *interval)
+{
+	u32 frame_pck = (sensor->mode.width + sensor->hblank->val) *
+			frame_length;
+	unsigned long div = gcd(frame_pck, sensor->pll_config->pixel_rate);
+
+	interval->numerator = frame_pck / div;
+	interval->denominator = sensor->pll_config->pixel_rate / div;
+}
+
+/*
+ * Frame length closest to the given interval at the current line length,
+ * within the VBLANK limits. Without an interval the shortest frame is used.
+ */
+static u32 ar0822_interval_frame_length(struct ar0822 *sensor,
+					const struct v4l2_fract *interval)
+{
+	u32 frame_length_min = sensor->mode.height + sensor->vblank->minimum;
+	u32 frame_length_max = sensor->mode.height + sensor->vblank->maximum;
+	u64 frame_length, div;
+
+	if (!interval->numerator || !interval->denominator)
+		return frame_length_min;
+
+	div = (u64)interval->denominator *
+	      (sensor->mode.width + sensor->hblank->val);
+	frame_length = div64_u64((u64)interval->numerator *
+					 sensor->pll_config->pixel_rate +
+					 div / 2,
+				 div);
+
+	return clamp_t(u64, frame_length, frame_length_min, frame_length_max);
+}
+
+/* Derive VBLANK from the requested frame interval, clamping the exposure */
+static void ar0822_apply_frame_interval(struct ar0822 *sensor)
+{
+	u32 frame_length =
+		ar0822_interval_frame_length(sensor, &sensor->frame_interval);
+
+	sensor->vblank_derived = true;
+	__v4l2_ctrl_s_ctrl(sensor->vblank, frame_length - sensor->mode.height);
+	sensor->vblank_derived = false;
+}
+
+static void ar0822_set_framing_limits(struct ar0822 *sensor)
+{
+	struct ar0822_timing timing;
+	int hblank;
+
+	ar0822_get_timing(sensor, &timing);
+
+	/*
+	 * Longer lines than the minimum scale the exposure time, see README.
+	 * The current HBLANK is kept, clamped to the new range.
+	 */
+	hblank = timing.line_length_pck_min - sensor->mode.width;
+	__v4l2_ctrl_modify_range(sensor->hblank, hblank,
+				 AR0822_LINE_LENGTH_PCK_MAX - sensor->mode.width,
+				 sensor->hblank->step, hblank);
+
+	ar0822_adjust_vblank_range(sensor);
+
+	/*
+	 * Keep the VBLANK set by userspace, clamped to the new range above, or
+	 * the requested frame rate, or set it to the default. Setting VBLANK
+	 * will adjust the exposure limits as well.
+	 */
+	if (sensor->vblank_user)
+		ar0822_adjust_exposure_range(sensor);
+	else
+		ar0822_apply_frame_interval(sensor);
+}
+
+static struct ar0822_frame_ctrls *ar0822_fctl_entry(struct ar0822 *sensor,
+						    unsigned int i)
+{
+	return &sensor->fctl.queue[(sensor->fctl.head + i) %
+				   AR0822_FCTL_QUEUE_LEN];
+}
+
+/*
+ * Queue settings for the frame with the given sequence number. Frames are
+ * numbered from 0 at stream on, matching the buffer sequence of the receiver.
+ * Settings for the same frame are merged, earlier frames are refused.
+ */
+static int ar0822_fctl_queue(struct ar0822 *sensor, const u32 *p)
+{
+	struct ar0822_frame_ctrls *entry = NULL;
+	unsigned long pending = 0;
+	unsigned int i;
+
+	for (i = 0; i < AR0822_FCTL_AMOUNT; i++)
+		if (p[i + 1] != AR0822_FCTL_KEEP)
+			pending |= BIT(i);
+
+	/* The default value of the control queues nothing */
+	if (!pending)
+		return 0;
+
+	if (sensor->fctl.amount) {
+		entry = ar0822_fctl_entry(sensor, sensor->fctl.amount - 1);
+		if (p[0] < entry->sequence)
+			return -EINVAL;
+		if (p[0] != entry->sequence)
+			entry = NULL;
+	}
+
+	if (!entry) {
+		if (sensor->fctl.amount == AR0822_FCTL_QUEUE_LEN)
+			return -EBUSY;
+
+		entry = ar0822_fctl_entry(sensor, sensor->fctl.amount++);
+		entry->sequence = p[0];
+		entry->pending = 0;
+	}
+
+	for_each_set_bit(i, &pending, AR0822_FCTL_AMOUNT)
+		entry->val[i] = p[i + 1];
+	entry->pending |= pending;
+
+	if (sensor->streaming) {
+		sensor->fctl.stalled = 0;
+		queue_delayed_work(system_highpri_wq, &sensor->fctl.work, 0);
+	}
+
+	return 0;
+}
+
+/* The frame counter wraps, only the frames since the last read add up */
+static int ar0822_fctl_update_sequence(struct ar0822 *sensor)
+{
+	u64 frame_count;
+	u16 frames;
+	int ret;
+
+	ret = cci_read(sensor->regmap, AR0822_REG_FRAME_COUNT, &frame_count,
+		       NULL);
+	if (ret)
+		return ret;
+
+	frames = (u16)(frame_count - sensor->fctl.frame_count);
+	sensor->fctl.sequence += frames;
+	sensor->fctl.frame_count = frame_count;
+
+	return 0;
+}
+
+/*
+ * The FLASH pin carries the strobe, which the sensor asserts from the start of
+ * the integration of the first row to the end of the integration of the last
+ * row, following the exposure.
+ */
+static u16 ar0822_flash_val(struct ar0822 *sensor)
+{
+	return sensor->flash_led_mode->val == V4L2_FLASH_LED_MODE_FLASH ?
+		       AR0822_FLASH_ENABLE :
+		       0;
+}
+
+static int ar0822_set_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct ar0822 *sensor =
+		container_of(ctrl->handler, struct ar0822, ctrl_hdlr);
+	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
+	struct ar0822_stat_mark mark;
+	bool powered;
+	u64 flash = 0;
+	int ret = 0, batch_ret;
+
+	ar0822_stat_begin(sensor, &mark);
+
+	/*
+	 * Applying V4L2 control value only happens
+	 * when power is up for streaming
+	 */
+	powered = pm_runtime_get_if_in_use(&client->dev) != 0;
+
+	/*
+	 * An HBLANK change may clamp VBLANK, a VBLANK change may clamp the
+	 * exposure, and exposure and gain are applied together as a cluster.
+	 * Latch such batches in one grouped parameter hold so that all of their
+	 * writes land on the same frame.
+	 */
+	if (powered && sensor->streaming &&
+	    (ctrl->id == V4L2_CID_HBLANK || ctrl->id == V4L2_CID_VBLANK ||
+	     ctrl->id == V4L2_CID_EXPOSURE ||
+	     ctrl->id == AR0822_CID_HDR_RATIO_T1_T2 ||
+	     ctrl->id == AR0822_CID_HDR_RATIO_T2_T3))
+		ar0822_ctrl_hold(sensor);
+
+	/* Writes triggered by range updates below join the same batch */
+	if (powered)
+		ar0822_batch_begin(sensor);
+
+	if (ctrl->id == V4L2_CID_HBLANK) {
+		/* The minimum frame length depends on the line length */
+		ar0822_adjust_vblank_range(sensor);
+	} else if (ctrl->id == V4L2_CID_VBLANK ||
+		   ctrl->id == AR0822_CID_HDR_RATIO_T1_T2 ||
+		   ctrl->id == AR0822_CID_HDR_RATIO_T2_T3) {
+		/*
+		 * A new VBLANK that the driver didn't derive itself replaces
+		 * the requested frame interval. The control handler setup at
+		 * stream on rewrites the current value and changes nothing.
+		 */
+		if (ctrl->id == V4L2_CID_VBLANK && !sensor->vblank_derived &&
+		    ctrl->val != ctrl->cur.val) {
+			sensor->frame_interval = (struct v4l2_fract){};
+			sensor->vblank_user = true;
+		}
+
+		ar0822_adjust_exposure_range(sensor);
+	} else if (ctrl->id == V4L2_CID_WIDE_DYNAMIC_RANGE) {
+		/*
+		 * The WIDE_DYNAMIC_RANGE control can also be applied immediately
+		 * as it doesn't set any registers. Don't do anything if the mode
+		 * already matches.
+		 */
+		if (sensor->mode.hdr != ctrl->val) {
+			dev_dbg(sensor->dev, "hdr %d\n", ctrl->val);
+
+			sensor->mode.hdr = ctrl->val;
+			ar0822_set_framing_limits(sensor);
+		}
+	} else if (ctrl->id == AR0822_CID_EMBEDDED_DATA) {
+		/* Embedded data lines take part of the frame time */
+		if (sensor->mode.embedded_data != ctrl->val) {
+			sensor->mode.embedded_data = ctrl->val;
+			ar0822_set_framing_limits(sensor);
+		}
+	} else if (ctrl->id == AR0822_CID_FRAME_CTRLS) {
+		/* Queued regardless of power, written by ar0822_fctl_work() */
+		ret = ar0822_fctl_queue(sensor, ctrl->p_new.p_u32);
+	}
+
+	if (!powered)
+		return ret;
+
+	switch (ctrl->id) {
+	case V4L2_CID_VBLANK:
+		dev_dbg(sensor->dev,
+			"ar0822_set_ctrl: AR0822_REG_FRAME_LENGTH_LINES %d\n",
+			sensor->mode.height + ctrl->val);
+		ret = ar0822_write(sensor, AR0822_REG_FRAME_LENGTH_LINES,
+				   sensor->mode.height + ctrl->val, NULL);
+		break;
+	case V4L2_CID_EXPOSURE:
+		/* Cluster master, ANALOGUE_GAIN is handled here as well */
+		if (sensor->exposure->is_new) {
+			dev_dbg(sensor->dev,
+				"ar0822_set_ctrl: AR0822_REG_COARSE_INTEGRATION_TIME %d\n",
+				sensor->exposure->val);
+			ar0822_write(sensor, AR0822_REG_COARSE_INTEGRATION_TIME,
+				     sensor->exposure->val, &ret);
+		}
+
+		if (sensor->gain->is_new) {
+			dev_dbg(sensor->dev,
+				"ar0822_set_ctrl: AR0822_REG_SENSOR_GAIN %d\n",
+				sensor->gain->val);
+			ar0822_write(sensor, AR0822_REG_SENSOR_GAIN,
+				     sensor->gain->val, &ret);
+		}
+		break;
+	case V4L2_CID_HFLIP:
+	case V4L2_CID_VFLIP:
+
+		dev_dbg(sensor->dev,
+			"ar0822_set_ctrl: AR0822_REG_IMAGE_ORIENTATION %d\n",
+			sensor->hflip->val | sensor->vflip->val << 1);
+		ret = ar0822_write(sensor, AR0822_REG_IMAGE_ORIENTATION,
+				   sensor->hflip->val | sensor->vflip->val << 1,
+				   NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN:
+		dev_dbg(sensor->dev, "AR0822_REG_TEST_PATTERN_MODE %d\n",
+			ar0822_test_pattern_val[ctrl->val]);
+
+		ret = ar0822_write(sensor, AR0822_REG_TEST_PATTERN_MODE,
+				   ar0822_test_pattern_val[ctrl->val], NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_RED:
+		ret = ar0822_write(sensor, AR0822_REG_TEST_DATA_RED, ctrl->val,
+				   NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_GREENR:
+		ret = ar0822_write(sensor, AR0822_REG_TEST_DATA_GREENR,
+				   ctrl->val, NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_BLUE:
+		ret = ar0822_write(sensor, AR0822_REG_TEST_DATA_BLUE, ctrl->val,
+				   NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_GREENB:
+		ret = ar0822_write(sensor, AR0822_REG_TEST_DATA_GREENB,
+				   ctrl->val, NULL);
+		break;
+	case V4L2_CID_HBLANK:
+		ret = ar0822_write(sensor, AR0822_REG_LINE_LENGTH_PCK,
+				   sensor->mode.width + ctrl->val, NULL);
+		break;
+	case AR0822_CID_HDR_RATIO_T1_T2:
+	case AR0822_CID_HDR_RATIO_T2_T3:
+		ret = ar0822_write(sensor, AR0822_REG_EXPOSURE_RATIO,
+				   ar0822_exposure_ratio_val(sensor), NULL);
+		break;
+	case AR0822_CID_EMBEDDED_DATA:
+		ar0822_write(sensor, AR0822_REG_SMIA_TEST,
+			     ar0822_embedded_data_smia_test[ctrl->val], &ret);
+		ar0822_write(sensor, AR0822_REG_READ_MODE,
+			     ar0822_read_mode_val(sensor), &ret);
+		break;
+	case V4L2_CID_WIDE_DYNAMIC_RANGE:
+	case AR0822_CID_FRAME_CTRLS:
+		/* Already handled above. */
+		break;
+	case V4L2_CID_FLASH_LED_MODE:
+		/* The other FLASH bits keep their reset values */
+		ar0822_read(sensor, AR0822_REG_FLASH, &flash, &ret);
+		ar0822_write(sensor, AR0822_REG_FLASH,
+			     (flash & ~AR0822_FLASH_ENABLE) |
+				     ar0822_flash_val(sensor),
+			     &ret);
+		break;
+	default:
+		dev_err(sensor->dev, "unhandled control %x\n", ctrl->id);
+		ret = -EINVAL;
+		break;
+	}
+
+	batch_ret = ar0822_batch_end(sensor);
+	if (!ret)
+		ret = batch_ret;
+
+	ar0822_stat_ctrl_end(sensor, ctrl, &mark);
+
+	pm_runtime_mark_last_busy(&client->dev);
+	pm_runtime_put_autosuspend(&client->dev);
+
+	return ret;
+}
+
+/* T2 and T3 follow T1 through the exposure ratios, frame count is read */
+static int ar0822_get_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct ar0822 *sensor =
+		container_of(ctrl->handler, struct ar0822, ctrl_hdlr);
+	u32 r1 = ar0822_hdr_ratios[sensor->hdr_ratio_t1_t2->cur.val];
+	u32 r2 = ar0822_hdr_ratios[sensor->hdr_ratio_t2_t3->cur.val];
+	int ret;
+
+	switch (ctrl->id) {
+	case AR0822_CID_FRAME_COUNT:
+		/* Sequence of the frame being output, as in frame sync events */
+		if (!sensor->streaming) {
+			ctrl->val = -1;
+			break;
+		}
+
+		ret = ar0822_fctl_update_sequence(sensor);
+		if (ret)
+			return ret;
+
+		ctrl->val = min_t(s64, sensor->fctl.sequence, S32_MAX);
+		break;
+	case AR0822_CID_EXPOSURE_T2:
+		ctrl->val = sensor->mode.hdr ? sensor->exposure->cur.val / r1 :
+					       0;
+		break;
+	case AR0822_CID_EXPOSURE_T3:
+		ctrl->val = sensor->mode.hdr ?
+				    sensor->exposure->cur.val / (r1 * r2) :
+				    0;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops ar0822_ctrl_ops = {
+	.g_volatile_ctrl = ar0822_get_volatile_ctrl,
+	.s_ctrl = ar0822_set_ctrl,
+};
+
+static const struct v4l2_ctrl_config ar0822_hdr_ratio_t1_t2_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_HDR_RATIO_T1_T2,
+	.name = "HDR T1/T2 Exposure Ratio",
+	.type = V4L2_CTRL_TYPE_INTEGER_MENU,
+	.max = ARRAY_SIZE(ar0822_hdr_ratios) - 1,
+	.def = AR0822_HDR_RATIO_DEFAULT,
+	.qmenu_int = ar0822_hdr_ratios,
+};
+
+static const struct v4l2_ctrl_config ar0822_hdr_ratio_t2_t3_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_HDR_RATIO_T2_T3,
+	.name = "HDR T2/T3 Exposure Ratio",
+	.type = V4L2_CTRL_TYPE_INTEGER_MENU,
+	.max = ARRAY_SIZE(ar0822_hdr_ratios) - 1,
+	.def = AR0822_HDR_RATIO_DEFAULT,
+	.qmenu_int = ar0822_hdr_ratios,
+};
+
+static const struct v4l2_ctrl_config ar0822_embedded_data_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_EMBEDDED_DATA,
+	.name = "Embedded Data",
+	.type = V4L2_CTRL_TYPE_MENU,
+	.max = ARRAY_SIZE(ar0822_embedded_data_menu) - 1,
+	.def = AR0822_EMBEDDED_DATA_DEFAULT,
+	.qmenu = ar0822_embedded_data_menu,
+};
+
+/* Integration times of the T2 and T3 exposures in lines (read only) */
+static const struct v4l2_ctrl_config ar0822_exposure_t2_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_EXPOSURE_T2,
+	.name = "Exposure T2",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	.max = 0xFFFF,
+	.step = 1,
+};
+
+static const struct v4l2_ctrl_config ar0822_frame_count_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_FRAME_COUNT,
+	.name = "Frame Count",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = -1,
+	.max = S32_MAX,
+	.step = 1,
+	.def = -1,
+};
+
+static const struct v4l2_ctrl_config ar0822_exposure_t3_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_EXPOSURE_T3,
+	.name = "Exposure T3",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	.max = 0xFFFF,
+	.step = 1,
+};
+
+/*
+ * Array of the target frame sequence followed by the settings indexed by
+ * enum ar0822_fctl_id, AR0822_FCTL_KEEP leaves a setting unchanged. Settings
+ * land on their frame on a best effort basis, see ar0822_fctl_work().
+ */
+static const struct v4l2_ctrl_config ar0822_frame_ctrls_ctrl = {
+	.ops = &ar0822_ctrl_ops,
+	.id = AR0822_CID_FRAME_CTRLS,
+	.name = "Frame Controls",
+	.type = V4L2_CTRL_TYPE_U32,
+	.flags = V4L2_CTRL_FLAG_EXECUTE_ON_WRITE,
+	.min = 0,
+	.max = U32_MAX,
+	.step = 1,
+	.def = AR0822_FCTL_KEEP,
+	.dims = { 1 + AR0822_FCTL_AMOUNT },
+};
+
+static const u32 ar0822_fctl_keep[1 + AR0822_FCTL_AMOUNT] = {
+	[0 ... AR0822_FCTL_AMOUNT] = AR0822_FCTL_KEEP,
+};
+
+/* ar0822_fctl_delays, indexed by enum ar0822_fctl_id */
+static const struct v4l2_ctrl_config ar0822_frame_ctrl_delays_ctrl = {
+	.id = AR0822_CID_FRAME_CTRL_DELAYS,
+	.name = "Frame Control Delays",
+	.type = V4L2_CTRL_TYPE_U8,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.min = 0,
+	.max = U8_MAX,
+	.step = 1,
+	.dims = { AR0822_FCTL_AMOUNT },
+};
+
+/*
+ * Write the queued settings that are due in the current frame. A setting for
+ * frame n with delay d is due in frame n - d, settings that are already late
+ * are written right away so that they take effect as soon as possible.
+ */
+static int ar0822_fctl_apply(struct ar0822 *sensor)
+{
+	/* Blanking goes first as it sets the exposure range */
+	static const u8 order[] = {
+		AR0822_FCTL_VBLANK,
+		AR0822_FCTL_EXPOSURE,
+		AR0822_FCTL_GAIN,
+	};
+	struct v4l2_ctrl *ctrls[AR0822_FCTL_AMOUNT] = {
+		[AR0822_FCTL_EXPOSURE] = sensor->exposure,
+		[AR0822_FCTL_GAIN] = sensor->gain,
+		[AR0822_FCTL_VBLANK] = sensor->vblank,
+	};
+	bool hold = sensor->streaming;
+	int ret = 0, batch_ret;
+	unsigned int i, j;
+
+	if (hold && ar0822_group_hold(sensor, true))
+		hold = false;
+
+	ar0822_batch_begin(sensor);
+
+	for (i = 0; i < ARRAY_SIZE(order) && !ret; i++) {
+		u8 id = order[i];
+
+		for (j = 0; j < sensor->fctl.amount; j++) {
+			struct ar0822_frame_ctrls *entry =
+				ar0822_fctl_entry(sensor, j);
+			s64 due = (s64)entry->sequence - ar0822_fctl_delays[id];
+
+			if (!(entry->pending & BIT(id)) ||
+			    due > sensor->fctl.sequence)
+				continue;
+
+			if (sensor->fctl.sequence >= 0 &&
+			    due < sensor->fctl.sequence)
+				dev_dbg(sensor->dev,
+					"frame %u: %s late by %lld frames\n",
+					entry->sequence, ctrls[id]->name,
+					sensor->fctl.sequence - due);
+
+			/* Failed and later settings stay queued for a retry */
+			ret = __v4l2_ctrl_s_ctrl(ctrls[id], entry->val[id]);
+			if (ret) {
+				dev_err(sensor->dev,
+					"frame %u: failed to set %s: %d\n",
+					entry->sequence, ctrls[id]->name, ret);
+				break;
+			}
+
+			entry->pending &= ~BIT(id);
+		}
+	}
+
+	while (sensor->fctl.amount && !ar0822_fctl_entry(sensor, 0)->pending) {
+		sensor->fctl.head = (sensor->fctl.head + 1) %
+				    AR0822_FCTL_QUEUE_LEN;
+		sensor->fctl.amount--;
+	}
+
+	batch_ret = ar0822_batch_end(sensor);
+	if (!ret)
+		ret = batch_ret;
+
+	if (hold) {
+		int hold_ret = ar0822_group_hold(sensor, false);
+
+		if (!ret)
+			ret = hold_ret;
+	}
+
+	return ret;
+}
+
+/* Poll the frame counter again after one frame period */
+static void ar0822_fctl_rearm(struct ar0822 *sensor)
+{
+	u64 frame_us = div_u64((u64)(sensor->mode.width + sensor->hblank->val) *
+				       (sensor->mode.height +
+					sensor->vblank->val) *
+				       USEC_PER_SEC,
+			       sensor->pll_config->pixel_rate);
+
+	queue_delayed_work(system_highpri_wq, &sensor->fctl.work,
+			   max(usecs_to_jiffies(frame_us), 1UL));
+}
+
+/*
+ * The sensor doesn't signal frame starts to the host, so poll the frame
+ * counter once per frame period for as long as settings are queued. Polling
+ * stops if the sensor stops counting frames and starts again when new
+ * settings are queued.
+ *
+ * The polling is jiffy granular and drifts against the frame period, so a
+ * poll can come late in a frame or skip one. Settings due in that frame are
+ * then written one frame later and take effect one frame late.
+ */
+static void ar0822_fctl_work(struct work_struct *work)
+{
+	struct ar0822 *sensor =
+		container_of(to_delayed_work(work), struct ar0822, fctl.work);
+	u16 frame_count;
+	int ret;
+
+	mutex_lock(&sensor->mutex);
+
+	if (!sensor->streaming || !sensor->fctl.amount)
+		goto unlock;
+
+	frame_count = sensor->fctl.frame_count;
+	ret = ar0822_fctl_update_sequence(sensor);
+	if (!ret)
+		ret = ar0822_fctl_apply(sensor);
+	if (ret) {
+		dev_err(sensor->dev, "Failed to apply frame controls: %d\n",
+			ret);
+		goto unlock;
+	}
+
+	if (sensor->fctl.frame_count != frame_count) {
+		sensor->fctl.stalled = 0;
+	} else if (++sensor->fctl.stalled >= AR0822_FCTL_STALL_FRAMES) {
+		dev_warn(sensor->dev, "No new frames, stopped polling\n");
+		goto unlock;
+	}
+
+	if (sensor->fctl.amount)
+		ar0822_fctl_rearm(sensor);
+
+unlock:
+	mutex_unlock(&sensor->mutex);
+}
+
+static int ar0822_ctrls_init(struct ar0822 *sensor)
+{
+	struct v4l2_fwnode_device_properties props;
+	struct v4l2_ctrl *ctrl;
+	struct ar0822_timing timing;
+	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
+	u8 link_freq_id =
+		sensor->pll_config->freq_link - ar0822_link_frequencies;
+	u32 exposure_max;
+	int ret;
+
+	ar0822_get_timing(sensor, &timing);
+
+	ret = v4l2_ctrl_handler_init(&sensor->ctrl_hdlr, 26);
+	if (ret)
+		return ret;
+
+	mutex_init(&sensor->mutex);
+	sensor->ctrl_hdlr.lock = &sensor->mutex;
+
+	/* Link frequency (read only) */
+	ctrl = v4l2_ctrl_new_int_menu(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
+				      V4L2_CID_LINK_FREQ,
 				      ARRAY_SIZE(ar0822_link_frequencies) - 1,
 				      link_freq_id, ar0822_link_frequencies);
 	if (ctrl)
@@ -995,11 +2352,9 @@ static int ar0822_ctrls_init(struct ar0822 *sensor)
 	 * in the ar0822_set_framing_limits() call below.
 	 */
 
-	/* Horizontal blanking (read only) */
+	/* Horizontal blanking control */
 	sensor->hblank = v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
-					   V4L2_CID_HBLANK, 0, 0xFFFF, 1, 0);
-	if (sensor->hblank)
-		sensor->hblank->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+					   V4L2_CID_HBLANK, 0, 0xFFFF, 2, 0);
 
 	/* Vertical blanking control */
 	sensor->vblank = v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
@@ -1007,17 +2362,21 @@ static int ar0822_ctrls_init(struct ar0822 *sensor)
 					   AR0822_VBLANK_STEP, 0);
 
 	/* Exposure */
-	exposure_max = timing->frame_length_lines_min - AR0822_EXPOSURE_MARGIN;
+	exposure_max = timing.frame_length_lines_min - AR0822_EXPOSURE_MARGIN;
 	sensor->exposure = v4l2_ctrl_new_std(
 		&sensor->ctrl_hdlr, &ar0822_ctrl_ops, V4L2_CID_EXPOSURE,
 		AR0822_EXPOSURE_MIN, exposure_max, AR0822_EXPOSURE_STEP,
 		exposure_max);
 
 	/* Analogue gain */
-	v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
-			  V4L2_CID_ANALOGUE_GAIN, AR0822_ANA_GAIN_MIN,
-			  AR0822_ANA_GAIN_MAX, AR0822_ANA_GAIN_STEP,
-			  AR0822_ANA_GAIN_MIN);
+	sensor->gain = v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
+					 V4L2_CID_ANALOGUE_GAIN,
+					 AR0822_ANA_GAIN_MIN,
+					 AR0822_ANA_GAIN_MAX,
+					 AR0822_ANA_GAIN_STEP,
+					 AR0822_ANA_GAIN_MIN);
+
+	v4l2_ctrl_cluster(2, &sensor->exposure);
 
 	/* Horizontal flip */
 	sensor->hflip = v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
@@ -1027,6 +2386,11 @@ static int ar0822_ctrls_init(struct ar0822 *sensor)
 	sensor->vflip = v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
 					  V4L2_CID_VFLIP, 0, 1, 1, 0);
 
+	/* FLASH pin strobe, it only follows the exposure, so there's no torch */
+	sensor->flash_led_mode = v4l2_ctrl_new_std_menu(
+		&sensor->ctrl_hdlr, &ar0822_ctrl_ops, V4L2_CID_FLASH_LED_MODE,
+		V4L2_FLASH_LED_MODE_FLASH, 0, V4L2_FLASH_LED_MODE_NONE);
+
 	/* Test patterns */
 	v4l2_ctrl_new_std_menu_items(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
 				     V4L2_CID_TEST_PATTERN,
@@ -1055,6 +2419,28 @@ static int ar0822_ctrls_init(struct ar0822 *sensor)
 		v4l2_ctrl_new_std(&sensor->ctrl_hdlr, &ar0822_ctrl_ops,
 				  V4L2_CID_WIDE_DYNAMIC_RANGE, 0, 1, 1, 0);
 
+	/* HDR exposure ratios, and the resulting T2 and T3 exposures */
+	sensor->hdr_ratio_t1_t2 = v4l2_ctrl_new_custom(
+		&sensor->ctrl_hdlr, &ar0822_hdr_ratio_t1_t2_ctrl, NULL);
+	sensor->hdr_ratio_t2_t3 = v4l2_ctrl_new_custom(
+		&sensor->ctrl_hdlr, &ar0822_hdr_ratio_t2_t3_ctrl, NULL);
+	v4l2_ctrl_new_custom(&sensor->ctrl_hdlr, &ar0822_exposure_t2_ctrl,
+			     NULL);
+	v4l2_ctrl_new_custom(&sensor->ctrl_hdlr, &ar0822_exposure_t3_ctrl,
+			     NULL);
+
+	sensor->embedded_data = v4l2_ctrl_new_custom(
+		&sensor->ctrl_hdlr, &ar0822_embedded_data_ctrl, NULL);
+
+	v4l2_ctrl_new_custom(&sensor->ctrl_hdlr, &ar0822_frame_count_ctrl,
+			     NULL);
+
+	/* Per-frame control queue and its delays (read only) */
+	sensor->frame_ctrls = v4l2_ctrl_new_custom(
+		&sensor->ctrl_hdlr, &ar0822_frame_ctrls_ctrl, NULL);
+	ctrl = v4l2_ctrl_new_custom(&sensor->ctrl_hdlr,
+				    &ar0822_frame_ctrl_delays_ctrl, NULL);
+
 	if (sensor->ctrl_hdlr.error) {
 		ret = sensor->ctrl_hdlr.error;
 		dev_err(&client->dev, "failed to init controls %d\n", ret);
@@ -1074,6 +2460,13 @@ static int ar0822_ctrls_init(struct ar0822 *sensor)
 
 	mutex_lock(&sensor->mutex);
 
+	ret = __v4l2_ctrl_s_ctrl_compound(ctrl, V4L2_CTRL_TYPE_U8,
+					  ar0822_fctl_delays);
+	if (ret) {
+		mutex_unlock(&sensor->mutex);
+		goto error;
+	}
+
 	ar0822_set_framing_limits(sensor);
 
 	mutex_unlock(&sensor->mutex);
@@ -1088,126 +2481,355 @@ error:
 
 static int ar0822_mode_stream_on(struct ar0822 *sensor)
 {
+	atomic64_inc(&sensor->stats.transfers);
+
 	return cci_write(sensor->regmap, AR0822_REG_MODE_SELECT,
 			 AR0822_MODE_SELECT_STREAM_ON, NULL);
 }
 
 static int ar0822_mode_stream_off(struct ar0822 *sensor)
 {
+	atomic64_inc(&sensor->stats.transfers);
+
 	return cci_write(sensor->regmap, AR0822_REG_MODE_SELECT,
 			 AR0822_MODE_SELECT_STREAM_OFF, NULL);
 }
 
-static int ar0822_get_bit_depth(enum ar0822_bit_depth_id id, u8 *bit_depth)
+static void ar0822_pack_seq(struct ar0822_packed_seq *packed)
 {
-	if (!bit_depth)
-		return -EINVAL;
+	struct ar0822_reg_sequence const *seq = packed->seq;
+	struct ar0822_reg_burst *burst = NULL;
+	unsigned int offset = 0;
+
+	for (unsigned int i = 0; i < seq->amount; i++) {
+		u32 reg = seq->regs[i].reg;
+		unsigned int width = CCI_REG_WIDTH_BYTES(reg);
+
+		if (!burst || CCI_REG_ADDR(reg) != burst->addr + burst->len) {
+			burst = &packed->bursts[packed->bursts_amount++];
+			burst->addr = CCI_REG_ADDR(reg);
+			burst->len = 0;
+			burst->offset = offset;
+			burst->first = i;
+			burst->amount = 0;
+		}
 
-	switch (id) {
-	case AR0822_BIT_DEPTH_ID_10BIT:
-		*bit_depth = 10;
-		break;
-	case AR0822_BIT_DEPTH_ID_12BIT:
-		*bit_depth = 12;
-		break;
-	default:
-		return -EINVAL;
+		/* CCI registers are big endian */
+		for (unsigned int b = 0; b < width; b++)
+			packed->data[offset++] =
+				seq->regs[i].val >> (8 * (width - 1 - b));
+
+		burst->len += width;
+		burst->amount++;
+
+		for (unsigned int j = i + 1; j < seq->amount; j++) {
+			if (seq->regs[j].reg == reg) {
+				__set_bit(i, packed->superseded);
+				break;
+			}
+		}
+	}
+}
+
+static int ar0822_pack_alloc(struct ar0822 *sensor,
+			     struct ar0822_packed_seq *packed,
+			     struct ar0822_reg_sequence const *seq)
+{
+	unsigned int len = 0;
+
+	for (unsigned int i = 0; i < seq->amount; i++)
+		len += CCI_REG_WIDTH_BYTES(seq->regs[i].reg);
+
+	packed->seq = seq;
+	packed->bursts = devm_kcalloc(sensor->dev, seq->amount,
+				      sizeof(*packed->bursts), GFP_KERNEL);
+	packed->data = devm_kzalloc(sensor->dev, len, GFP_KERNEL);
+	packed->superseded =
+		devm_bitmap_zalloc(sensor->dev, seq->amount, GFP_KERNEL);
+	if (!packed->bursts || !packed->data || !packed->superseded)
+		return -ENOMEM;
+
+	ar0822_pack_seq(packed);
+
+	return 0;
+}
+
+struct ar0822_blob_entry {
+	struct cci_reg_sequence reg;
+	unsigned int src;
+};
+
+static unsigned int ar0822_blob_index(unsigned int format_id,
+				      enum ar0822_bit_depth_id bit_depth,
+				      bool hdr)
+{
+	return (format_id * AR0822_BIT_DEPTH_ID_AMOUNT + bit_depth) * 2 + hdr;
+}
+
+/*
+ * Flatten all tables and computed writes of one mode into a single write
+ * list in the order the tables are written. A register written by several
+ * tables keeps the writes of the last one only. Repeated writes within one
+ * table are kept in order, as the manufacturer tables contain such
+ * sequences. Registers at consecutive addresses in the list are packed into
+ * bursts.
+ */
+static int ar0822_build_blob(struct ar0822 *sensor,
+			     struct ar0822_packed_seq *packed,
+			     struct ar0822_format const *format,
+			     enum ar0822_bit_depth_id bit_depth, bool hdr)
+{
+	struct ar0822_pll_config const *pll_config = sensor->pll_config;
+	u16 data_format = hdr ? AR0822_DATA_FORMAT_RAW_HDR :
+				AR0822_DATA_FORMAT_RAW_LIN;
+	struct cci_reg_sequence op_word[1], serial[2];
+	/* In the order the tables used to be written, later ones override */
+	struct ar0822_reg_sequence const srcs[] = {
+		pll_config->regs_pll,
+		AR0822_REG_SEQ(op_word),
+		pll_config->regs_mipi[bit_depth],
+		ar0822_seq_common,
+		hdr ? ar0822_seq_mfr_hdr : ar0822_seq_mfr_common,
+		format->reg_sequence,
+		AR0822_REG_SEQ(serial),
+		hdr ? ar0822_seq_hdr : (struct ar0822_reg_sequence){},
+	};
+	struct ar0822_blob_entry *entries;
+	struct ar0822_reg_sequence *seq;
+	struct cci_reg_sequence *regs;
+	unsigned int amount = 0, kept = 0;
+	u8 bpp;
+	int ret;
+
+	ret = ar0822_get_bit_depth(bit_depth, &bpp);
+	if (ret)
+		return ret;
+
+	/* op_word_clk_div = output bit depth (bits) / 2 */
+	op_word[0].reg = AR0822_REG_OP_WORD_CLK_DIV;
+	op_word[0].val = bpp / 2;
+
+	serial[0].reg = AR0822_REG_SERIAL_FORMAT;
+	serial[0].val = 0x0200 | sensor->hw_config.num_data_lanes;
+	serial[1].reg = AR0822_REG_DATA_FORMAT_BITS;
+	serial[1].val = (data_format << 8) | bpp;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(srcs); i++)
+		amount += srcs[i].amount;
+
+	entries = kcalloc(amount, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	amount = 0;
+	for (unsigned int i = 0; i < ARRAY_SIZE(srcs); i++) {
+		for (unsigned int j = 0; j < srcs[i].amount; j++) {
+			entries[amount].reg = srcs[i].regs[j];
+			entries[amount].src = i;
+			amount++;
+		}
+	}
+
+	for (unsigned int i = 0; i < amount; i++) {
+		bool overridden = false;
+
+		for (unsigned int j = i + 1; j < amount; j++) {
+			if (entries[j].reg.reg == entries[i].reg.reg &&
+			    entries[j].src != entries[i].src) {
+				overridden = true;
+				break;
+			}
+		}
+
+		if (!overridden)
+			entries[kept++] = entries[i];
+	}
+
+	seq = devm_kzalloc(sensor->dev, sizeof(*seq), GFP_KERNEL);
+	regs = devm_kcalloc(sensor->dev, kept, sizeof(*regs), GFP_KERNEL);
+	if (!seq || !regs) {
+		kfree(entries);
+		return -ENOMEM;
+	}
+
+	for (unsigned int i = 0; i < kept; i++)
+		regs[i] = entries[i].reg;
+
+	kfree(entries);
+
+	seq->regs = regs;
+	seq->amount = kept;
+
+	return ar0822_pack_alloc(sensor, packed, seq);
+}
+
+/*
+ * Build the flattened setup of every format, bit depth and HDR mode of the
+ * selected PLL configuration, so that stream-on replays a single list.
+ */
+static int ar0822_build_blobs(struct ar0822 *sensor)
+{
+	struct ar0822_pll_config const *pll_config = sensor->pll_config;
+	unsigned int amount = pll_config->formats_amount *
+			      AR0822_BIT_DEPTH_ID_AMOUNT * 2;
+	int ret;
+
+	sensor->blobs = devm_kcalloc(sensor->dev, amount,
+				     sizeof(*sensor->blobs), GFP_KERNEL);
+	if (!sensor->blobs)
+		return -ENOMEM;
+
+	for (unsigned int f = 0; f < pll_config->formats_amount; f++) {
+		for (unsigned int b = 0; b < AR0822_BIT_DEPTH_ID_AMOUNT; b++) {
+			for (unsigned int hdr = 0; hdr < 2; hdr++) {
+				unsigned int i = ar0822_blob_index(f, b, hdr);
+
+				ret = ar0822_build_blob(sensor,
+							&sensor->blobs[i],
+							&pll_config->formats[f],
+							b, hdr);
+				if (ret)
+					return ret;
+			}
+		}
 	}
 
 	return 0;
 }
 
-static inline int
-ar0822_reg_seq_write(struct regmap *regmap,
-		     struct ar0822_reg_sequence const *reg_sequence)
+/* Index of the last write in the table to the register of entry i */
+static unsigned int ar0822_packed_final(struct ar0822_packed_seq const *packed,
+					unsigned int i)
 {
-	return cci_multi_reg_write(regmap, reg_sequence->regs,
-				   reg_sequence->amount, NULL);
+	struct cci_reg_sequence const *regs = packed->seq->regs;
+	unsigned int final = i;
+
+	if (!test_bit(i, packed->superseded))
+		return i;
+
+	for (unsigned int j = i + 1; j < packed->seq->amount; j++) {
+		if (regs[j].reg == regs[i].reg)
+			final = j;
+	}
+
+	return final;
 }
 
-static int ar0822_config_pll(struct ar0822 *sensor)
+static int ar0822_burst_write(struct ar0822 *sensor,
+			      struct ar0822_packed_seq const *packed,
+			      struct ar0822_reg_burst const *burst)
 {
+	struct cci_reg_sequence const *regs = packed->seq->regs;
+	unsigned int i;
 	int ret;
-	u8 bit_depth;
 
-	ret = ar0822_get_bit_depth(sensor->mode.bit_depth, &bit_depth);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Unsupported bit depth id %d\n",
-			sensor->mode.bit_depth);
-		return ret;
-	}
+	/*
+	 * Skip the burst if the sensor already holds all of its values. For
+	 * registers written repeatedly only the final value counts.
+	 */
+	for (i = burst->first; i < burst->first + burst->amount; i++) {
+		unsigned int final = ar0822_packed_final(packed, i);
+
+		if (!ar0822_shadow_match(sensor, regs[final].reg,
+					 regs[final].val))
+			break;
+	}
+
+	if (i == burst->first + burst->amount)
+		return 0;
+
+	ret = regmap_bulk_write(sensor->regmap, burst->addr,
+				&packed->data[burst->offset], burst->len);
+	atomic64_inc(&sensor->stats.transfers);
+	if (ret)
+		dev_err(sensor->dev, "Error writing reg 0x%04x: %d\n",
+			burst->addr, ret);
+
+	for (i = burst->first; i < burst->first + burst->amount; i++)
+		ar0822_shadow_update(sensor, regs[i].reg, regs[i].val, ret);
 
-	/* Configure PLL */
-	ret = ar0822_reg_seq_write(sensor->regmap,
-				   &sensor->pll_config->regs_pll);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to write PLL config: %d\n", ret);
-		return ret;
-	}
+	return ret;
+}
 
-	/* op_word_clk_div = output bit depth (bits) / 2 */
-	ret = cci_write(sensor->regmap, AR0822_REG_OP_WORD_CLK_DIV,
-			bit_depth / 2, NULL);
-	if (ret < 0) {
-		dev_err(sensor->dev,
-			"Failed to write AR0822_REG_OP_WORD_CLK_DIV: %d\n",
-			ret);
-		return ret;
-	}
+static int ar0822_packed_seq_write(struct ar0822 *sensor,
+				   struct ar0822_packed_seq const *packed)
+{
+	int ret = 0;
 
-	/* Configure MIPI timing */
-	ret = ar0822_reg_seq_write(
-		sensor->regmap,
-		&sensor->pll_config->regs_mipi[sensor->mode.bit_depth]);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to write MIPI timing config: %d\n",
-			ret);
-		return ret;
-	}
+	for (unsigned int i = 0; i < packed->bursts_amount && !ret; i++)
+		ret = ar0822_burst_write(sensor, packed, &packed->bursts[i]);
 
 	return ret;
 }
 
-static int ar0822_config_serial_format(struct ar0822 *sensor)
+/*
+ * Replay the flattened setup of the current mode: PLL, MIPI timing, static
+ * and manufacturer registers, format and serial format. Values the sensor
+ * already holds are skipped, so a warm restart of the same mode writes
+ * nothing here.
+ *
+ * The HDR and linear manufacturer tables don't cover the same registers, and
+ * their repeated writes are sequences that have to run in full. Forget the
+ * shadow when the HDR state differs from the last static setup, so that the
+ * whole setup is written again.
+ */
+static int ar0822_config_mode(struct ar0822 *sensor)
 {
+	unsigned int format_id =
+		sensor->mode.format - sensor->pll_config->formats;
+	unsigned int i = ar0822_blob_index(format_id, sensor->mode.bit_depth,
+					   sensor->mode.hdr);
 	int ret;
-	u8 bit_depth;
-	u16 data_format = sensor->mode.hdr ? AR0822_DATA_FORMAT_RAW_HDR :
-					     AR0822_DATA_FORMAT_RAW_LIN;
 
-	ret = ar0822_get_bit_depth(sensor->mode.bit_depth, &bit_depth);
-	if (ret < 0)
-		return ret;
+	if (sensor->static_init_done &&
+	    sensor->static_init_hdr != sensor->mode.hdr)
+		xa_destroy(&sensor->reg_shadow);
 
-	ret = cci_write(sensor->regmap, AR0822_REG_SERIAL_FORMAT,
-			(0x0200 | sensor->hw_config.num_data_lanes), NULL);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to set serial format: %d\n", ret);
+	sensor->static_init_done = false;
+
+	ret = ar0822_packed_seq_write(sensor, &sensor->blobs[i]);
+	if (ret) {
+		dev_err(sensor->dev, "Failed to configure mode: %d\n", ret);
 		return ret;
 	}
 
-	ret = cci_write(sensor->regmap, AR0822_REG_DATA_FORMAT_BITS,
-			((data_format << 8) | bit_depth), NULL);
+	sensor->static_init_done = true;
+	sensor->static_init_hdr = sensor->mode.hdr;
 
-	return ret;
+	return 0;
 }
 
-static int ar0822_config_mfr(struct ar0822 *sensor)
+/* Window, output size, read mode and the line length that depends on them */
+static int ar0822_config_window(struct ar0822 *sensor)
 {
-	int ret = 0;
-
-	if (sensor->mode.hdr) {
-		dev_dbg(sensor->dev, "Initializing hdr mfr registers\n");
-		ret = cci_multi_reg_write(sensor->regmap, ar0822_regs_mfr_hdr,
-					  ARRAY_SIZE(ar0822_regs_mfr_hdr),
-					  NULL);
-	} else {
-		dev_dbg(sensor->dev, "Initializing common mfr registers\n");
-		ret = cci_multi_reg_write(sensor->regmap,
-					  ar0822_regs_mfr_common,
-					  ARRAY_SIZE(ar0822_regs_mfr_common),
-					  NULL);
-	}
+	struct v4l2_rect const *crop = &sensor->mode.crop;
+	int ret = 0, batch_ret;
+
+	/* Both register groups are consecutive, the batch makes them bursts */
+	ar0822_batch_begin(sensor);
+
+	ar0822_write(sensor, AR0822_REG_X_ADDR_START, crop->left, &ret);
+	ar0822_write(sensor, AR0822_REG_X_ADDR_END,
+		     crop->left + crop->width - 1, &ret);
+	ar0822_write(sensor, AR0822_REG_Y_ADDR_START, crop->top, &ret);
+	ar0822_write(sensor, AR0822_REG_Y_ADDR_END,
+		     crop->top + crop->height - 1, &ret);
+	ar0822_write(sensor, AR0822_REG_X_OUTPUT_CONTROL, sensor->mode.width,
+		     &ret);
+	ar0822_write(sensor, AR0822_REG_Y_OUTPUT_CONTROL, sensor->mode.height,
+		     &ret);
+	ar0822_write(sensor, AR0822_REG_READ_MODE, ar0822_read_mode_val(sensor),
+		     &ret);
+
+	/* Line length of the current mode, including the user's HBLANK */
+	ar0822_write(sensor, AR0822_REG_LINE_LENGTH_PCK,
+		     sensor->mode.width + sensor->hblank->val, &ret);
+
+	batch_ret = ar0822_batch_end(sensor);
+	if (!ret)
+		ret = batch_ret;
+	if (ret)
+		dev_err(sensor->dev, "Failed to configure window: %d\n", ret);
 
 	return ret;
 }
@@ -1215,79 +2837,75 @@ static int ar0822_config_mfr(struct ar0822 *sensor)
 static int ar0822_start_streaming(struct ar0822 *sensor)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
-	struct ar0822_timing const *timing = ar0822_get_timing(sensor);
-	int ret;
+	struct v4l2_event start_ev = {
+		.type = V4L2_EVENT_FRAME_SYNC,
+		.u.frame_sync.frame_sequence = 0,
+	};
+	struct ar0822_stat_mark start, mark;
+	u64 frame_count = 0;
+	int ret, batch_ret;
+
+	ar0822_stat_begin(sensor, &start);
 
 	ret = pm_runtime_resume_and_get(&client->dev);
 	if (ret < 0)
 		return ret;
 
-	/* Configure PLL and MIPI timings */
-	ret = ar0822_config_pll(sensor);
+	/* Configure PLL, MIPI timings, static registers and format */
+	ar0822_stat_begin(sensor, &mark);
+	ret = ar0822_config_mode(sensor);
 	if (ret < 0)
 		return ret;
+	ar0822_stat_end(sensor, AR0822_STAT_CONFIG_MODE, &mark);
 
-	/* Configure registers common for all modes */
-	ret = cci_multi_reg_write(sensor->regmap, ar0822_regs_common,
-				  ARRAY_SIZE(ar0822_regs_common), NULL);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to write common regs: %d\n", ret);
-		return ret;
-	}
-
-	/* Configure manufacturer recommended registers */
-	ret = ar0822_config_mfr(sensor);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to write mfr regs: %d\n", ret);
+	/* Configure window and line length */
+	ar0822_stat_begin(sensor, &mark);
+	ret = ar0822_config_window(sensor);
+	if (ret < 0)
 		return ret;
-	}
+	ar0822_stat_end(sensor, AR0822_STAT_CONFIG_WINDOW, &mark);
 
-	/* Configure image format */
-	ret = ar0822_reg_seq_write(sensor->regmap,
-				   &sensor->mode.format->reg_sequence);
-	if (ret < 0) {
-		dev_err(sensor->dev, "Failed to configure format: %d\n", ret);
+	/* Apply customized values from user */
+	ar0822_stat_begin(sensor, &mark);
+	ar0822_batch_begin(sensor);
+	ret = __v4l2_ctrl_handler_setup(sensor->subdev.ctrl_handler);
+	batch_ret = ar0822_batch_end(sensor);
+	if (!ret)
+		ret = batch_ret;
+	ar0822_stat_end(sensor, AR0822_STAT_CTRL_SETUP, &mark);
+	if (ret) {
+		dev_err(sensor->dev, "Failed to setup controls: %d\n", ret);
 		return ret;
 	}
 
-	/* Configure serial format */
-	ret = ar0822_config_serial_format(sensor);
+	/* Frame 0 is the first one counted after the value read here */
+	ret = cci_read(sensor->regmap, AR0822_REG_FRAME_COUNT, &frame_count,
+		       NULL);
+	sensor->fctl.frame_count = frame_count;
+	sensor->fctl.sequence = -1;
+	if (!ret)
+		ret = ar0822_fctl_apply(sensor);
 	if (ret) {
-		dev_err(sensor->dev, "Failed to configure serial format: %d\n",
+		dev_err(sensor->dev, "Failed to apply frame controls: %d\n",
 			ret);
 		return ret;
 	}
 
-	if (sensor->hdr_mode->val) {
-		dev_info(sensor->dev, "Initializing hdr mode\n");
-
-		ret = cci_multi_reg_write(sensor->regmap, ar0822_regs_hdr,
-					  ARRAY_SIZE(ar0822_regs_hdr), NULL);
-
-		if (ret) {
-			dev_err(sensor->dev, "Failed to config hdr mode: %d\n",
-				ret);
-			return ret;
-		}
-	}
-
-	/* Set fixed line length pck for current mode */
-	ret = cci_write(sensor->regmap, AR0822_REG_LINE_LENGTH_PCK,
-			timing->line_length_pck_min, NULL);
-	if (ret) {
-		dev_err(sensor->dev, "Failed to set line length: %d\n", ret);
+	ar0822_stat_begin(sensor, &mark);
+	ret = ar0822_mode_stream_on(sensor);
+	if (ret)
 		return ret;
-	}
+	ar0822_stat_end(sensor, AR0822_STAT_STREAM_ON, &mark);
 
-	/* Apply customized values from user */
-	ret = __v4l2_ctrl_handler_setup(sensor->subdev.ctrl_handler);
-	if (ret) {
-		dev_err(sensor->dev, "Failed to setup controls: %d\n", ret);
-		return ret;
-	}
+	/*
+	 * Mark the stream start, the start of each frame is signalled by the
+	 * receiver where it supports frame sync events.
+	 */
+	v4l2_event_queue(sensor->subdev.devnode, &start_ev);
 
-	ret = ar0822_mode_stream_on(sensor);
-	return ret;
+	ar0822_stat_end(sensor, AR0822_STAT_START_STREAMING, &start);
+
+	return 0;
 }
 
 /* Stop streaming */
@@ -1296,10 +2914,20 @@ static void ar0822_stop_streaming(struct ar0822 *sensor)
 	struct i2c_client *client = v4l2_get_subdevdata(&sensor->subdev);
 	int ret;
 
+	ar0822_ctrl_hold_release(sensor);
+
 	ret = ar0822_mode_stream_off(sensor);
 	if (ret)
 		dev_err(&client->dev, "%s failed to set stream\n", __func__);
 
+	/*
+	 * Queued settings refer to frames of this stream only. Reset the queue
+	 * control too, or the control setup replays it on the next stream on.
+	 */
+	sensor->fctl.amount = 0;
+	__v4l2_ctrl_s_ctrl_compound(sensor->frame_ctrls, V4L2_CTRL_TYPE_U32,
+				    ar0822_fctl_keep);
+
 	pm_runtime_mark_last_busy(&client->dev);
 	pm_runtime_put_autosuspend(&client->dev);
 }
@@ -1333,6 +2961,12 @@ static int ar0822_set_stream(struct v4l2_subdev *sd, int enable)
 	__v4l2_ctrl_grab(sensor->vflip, enable);
 	__v4l2_ctrl_grab(sensor->hflip, enable);
 	__v4l2_ctrl_grab(sensor->hdr_mode, enable);
+	__v4l2_ctrl_grab(sensor->embedded_data, enable);
+
+	if (enable && sensor->fctl.amount) {
+		sensor->fctl.stalled = 0;
+		ar0822_fctl_rearm(sensor);
+	}
 
 	mutex_unlock(&sensor->mutex);
 
@@ -1437,19 +3071,31 @@ static int ar0822_enum_frame_size(struct v4l2_subdev *sd,
 
 		fse->min_width = AR0822_EMBEDDED_LINE_WIDTH;
 		fse->max_width = fse->min_width;
-		fse->min_height = AR0822_NUM_EMBEDDED_LINES;
+		fse->min_height =
+			ar0822_embedded_data_lines[sensor->mode.embedded_data];
 		fse->max_height = fse->min_height;
 	}
 
 	return 0;
 }
 
+/* Select a format together with its default full window crop */
+static void ar0822_set_mode_format(struct ar0822 *sensor,
+				   struct ar0822_format const *format)
+{
+	sensor->mode.format = format;
+	sensor->mode.crop = format->crop;
+	sensor->mode.width = format->width;
+	sensor->mode.height = format->height;
+}
+
 static void ar0822_set_default_format(struct ar0822 *sensor)
 {
 	/* Set default mode to max resolution */
-	sensor->mode.format = &sensor->pll_config->formats[0];
+	ar0822_set_mode_format(sensor, &sensor->pll_config->formats[0]);
 	sensor->mode.bit_depth = AR0822_BIT_DEPTH_ID_10BIT;
 	sensor->mode.hdr = false;
+	sensor->mode.embedded_data = AR0822_EMBEDDED_DATA_DEFAULT;
 	sensor->fmt_code = ar0822_format_codes[0];
 }
 
@@ -1463,19 +3109,23 @@ static void ar0822_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
 }
 
 static void ar0822_update_image_pad_format(struct ar0822 *sensor,
-					   const struct ar0822_format *format,
+					   unsigned int width,
+					   unsigned int height,
 					   struct v4l2_subdev_format *fmt)
 {
-	fmt->format.width = format->width;
-	fmt->format.height = format->height;
+	fmt->format.width = width;
+	fmt->format.height = height;
 	fmt->format.field = V4L2_FIELD_NONE;
 	ar0822_reset_colorspace(&fmt->format);
 }
 
-static void ar0822_update_metadata_pad_format(struct v4l2_subdev_format *fmt)
+/* The line count follows the embedded data control, 0 when disabled */
+static void ar0822_update_metadata_pad_format(struct ar0822 *sensor,
+					      struct v4l2_subdev_format *fmt)
 {
 	fmt->format.width = AR0822_EMBEDDED_LINE_WIDTH;
-	fmt->format.height = AR0822_NUM_EMBEDDED_LINES;
+	fmt->format.height =
+		ar0822_embedded_data_lines[sensor->mode.embedded_data];
 	fmt->format.code = MEDIA_BUS_FMT_SENSOR_DATA;
 	fmt->format.field = V4L2_FIELD_NONE;
 }
@@ -1502,12 +3152,13 @@ static int ar0822_get_pad_format(struct v4l2_subdev *sd,
 		fmt->format = *try_fmt;
 	} else {
 		if (fmt->pad == IMAGE_PAD) {
-			ar0822_update_image_pad_format(
-				sensor, sensor->mode.format, fmt);
+			ar0822_update_image_pad_format(sensor,
+						       sensor->mode.width,
+						       sensor->mode.height, fmt);
 			fmt->format.code = ar0822_get_format_code(
 				sensor, sensor->fmt_code);
 		} else {
-			ar0822_update_metadata_pad_format(fmt);
+			ar0822_update_metadata_pad_format(sensor, fmt);
 		}
 	}
 
@@ -1522,6 +3173,9 @@ static int ar0822_set_pad_format(struct v4l2_subdev *sd,
 	struct ar0822 *sensor = to_ar0822(sd);
 	struct ar0822_format const *format;
 	struct v4l2_mbus_framefmt *framefmt;
+	unsigned int width, height;
+	bool keep_crop;
+	int ret = 0;
 
 	if (fmt->pad >= NUM_PADS)
 		return -EINVAL;
@@ -1537,14 +3191,42 @@ static int ar0822_set_pad_format(struct v4l2_subdev *sd,
 			sensor->pll_config->formats_amount, width, height,
 			fmt->format.width, fmt->format.height);
 
-		ar0822_update_image_pad_format(sensor, format, fmt);
+		/*
+		 * Requesting the size of the active crop keeps the crop, any
+		 * other size selects a format and resets the crop to its
+		 * default window.
+		 */
+		keep_crop = fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE &&
+			    fmt->format.width == sensor->mode.width &&
+			    fmt->format.height == sensor->mode.height;
+		if (keep_crop) {
+			format = sensor->mode.format;
+			width = sensor->mode.width;
+			height = sensor->mode.height;
+		} else {
+			width = format->width;
+			height = format->height;
+		}
+
+		ar0822_update_image_pad_format(sensor, width, height, fmt);
 		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
 			framefmt =
 				v4l2_subdev_state_get_format(state, fmt->pad);
 			*framefmt = fmt->format;
+			*v4l2_subdev_state_get_crop(state, fmt->pad) =
+				format->crop;
 		} else if ((sensor->mode.format != format) ||
+			   (sensor->mode.width != width) ||
+			   (sensor->mode.height != height) ||
 			   (sensor->fmt_code != fmt->format.code)) {
-			sensor->mode.format = format;
+			/* The receiver keeps the format it was started with */
+			if (sensor->streaming) {
+				ret = -EBUSY;
+				goto unlock;
+			}
+
+			if (!keep_crop)
+				ar0822_set_mode_format(sensor, format);
 			ar0822_get_bit_depth_id(fmt->format.code,
 						&sensor->mode.bit_depth);
 			sensor->fmt_code = fmt->format.code;
@@ -1556,14 +3238,15 @@ static int ar0822_set_pad_format(struct v4l2_subdev *sd,
 				v4l2_subdev_state_get_format(state, fmt->pad);
 			*framefmt = fmt->format;
 		} else {
-			/* Only one embedded data mode is supported */
-			ar0822_update_metadata_pad_format(fmt);
+			/* Set up by the embedded data control */
+			ar0822_update_metadata_pad_format(sensor, fmt);
 		}
 	}
 
+unlock:
 	mutex_unlock(&sensor->mutex);
 
-	return 0;
+	return ret;
 }
 
 static const struct v4l2_rect *
@@ -1574,7 +3257,7 @@ __ar0822_get_pad_crop(struct ar0822 *sensor, struct v4l2_subdev_state *sd_state,
 	case V4L2_SUBDEV_FORMAT_TRY:
 		return v4l2_subdev_state_get_crop(sd_state, pad);
 	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &sensor->mode.format->crop;
+		return &sensor->mode.crop;
 	}
 
 	return NULL;
@@ -1615,8 +3298,209 @@ static int ar0822_get_selection(struct v4l2_subdev *sd,
 	return -EINVAL;
 }
 
+/*
+ * Align a crop rectangle to the binning of the current format and fit it
+ * into the pixel array.
+ */
+static void ar0822_align_crop(struct v4l2_rect *r, unsigned int bin_x,
+			      unsigned int bin_y)
+{
+	r->width = clamp_t(u32, rounddown(r->width, AR0822_CROP_ALIGN * bin_x),
+			   AR0822_OUTPUT_MIN_WIDTH * bin_x,
+			   AR0822_PIXEL_ARRAY_WIDTH);
+	r->height = clamp_t(u32,
+			    rounddown(r->height, AR0822_CROP_ALIGN * bin_y),
+			    AR0822_OUTPUT_MIN_HEIGHT * bin_y,
+			    AR0822_PIXEL_ARRAY_HEIGHT);
+
+	r->left = clamp_t(s32, r->left, AR0822_PIXEL_ARRAY_LEFT,
+			  AR0822_PIXEL_ARRAY_LEFT + AR0822_PIXEL_ARRAY_WIDTH -
+				  r->width);
+	r->left = AR0822_PIXEL_ARRAY_LEFT +
+		  rounddown(r->left - AR0822_PIXEL_ARRAY_LEFT,
+			    AR0822_CROP_ALIGN);
+	r->top = clamp_t(s32, r->top, AR0822_PIXEL_ARRAY_TOP,
+			 AR0822_PIXEL_ARRAY_TOP + AR0822_PIXEL_ARRAY_HEIGHT -
+				 r->height);
+	r->top = AR0822_PIXEL_ARRAY_TOP +
+		 rounddown(r->top - AR0822_PIXEL_ARRAY_TOP, AR0822_CROP_ALIGN);
+}
+
+static int ar0822_set_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_state *sd_state,
+				struct v4l2_subdev_selection *sel)
+{
+	struct ar0822 *sensor = to_ar0822(sd);
+	struct ar0822_format const *format;
+	struct v4l2_mbus_framefmt *try_fmt = NULL;
+	struct v4l2_rect *try_crop = NULL;
+	unsigned int bin_x, bin_y;
+	int ret = 0;
+
+	if (sel->target != V4L2_SEL_TGT_CROP || sel->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&sensor->mutex);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE && sensor->streaming) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	/* The crop keeps the skipping and binning of the current format */
+	format = sensor->mode.format;
+	bin_x = format->crop.width / format->width;
+	bin_y = format->crop.height / format->height;
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY) {
+		try_fmt = v4l2_subdev_state_get_format(sd_state, sel->pad);
+		try_crop = v4l2_subdev_state_get_crop(sd_state, sel->pad);
+
+		/* The try crop and format differ by the try format binning */
+		if (try_fmt->width && try_fmt->height &&
+		    try_crop->width >= try_fmt->width &&
+		    try_crop->height >= try_fmt->height) {
+			bin_x = try_crop->width / try_fmt->width;
+			bin_y = try_crop->height / try_fmt->height;
+		}
+	}
+
+	ar0822_align_crop(&sel->r, bin_x, bin_y);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_TRY) {
+		*try_crop = sel->r;
+		try_fmt->width = sel->r.width / bin_x;
+		try_fmt->height = sel->r.height / bin_y;
+	} else {
+		sensor->mode.crop = sel->r;
+		sensor->mode.width = sel->r.width / bin_x;
+		sensor->mode.height = sel->r.height / bin_y;
+
+		ar0822_set_framing_limits(sensor);
+	}
+
+unlock:
+	mutex_unlock(&sensor->mutex);
+
+	return ret;
+}
+
+static int ar0822_get_frame_interval(struct v4l2_subdev *sd,
+				     struct v4l2_subdev_state *state,
+				     struct v4l2_subdev_frame_interval *fi)
+{
+	struct ar0822 *sensor = to_ar0822(sd);
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	if (fi->which == V4L2_SUBDEV_FORMAT_TRY) {
+		fi->interval = *v4l2_subdev_state_get_interval(state, fi->pad);
+		return 0;
+	}
+
+	mutex_lock(&sensor->mutex);
+	ar0822_get_interval(sensor, sensor->mode.height + sensor->vblank->val,
+			    &fi->interval);
+	mutex_unlock(&sensor->mutex);
+
+	return 0;
+}
+
+/*
+ * The requested interval is kept and VBLANK is derived from it again
+ * whenever the format, HDR mode or embedded data change the frame timing,
+ * until VBLANK is set directly. An interval of 0 selects the shortest frame
+ * again.
+ */
+static int ar0822_set_frame_interval(struct v4l2_subdev *sd,
+				     struct v4l2_subdev_state *state,
+				     struct v4l2_subdev_frame_interval *fi)
+{
+	struct ar0822 *sensor = to_ar0822(sd);
+	u32 frame_length;
+
+	if (fi->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	mutex_lock(&sensor->mutex);
+
+	if (fi->which == V4L2_SUBDEV_FORMAT_TRY) {
+		frame_length = ar0822_interval_frame_length(sensor,
+							    &fi->interval);
+		ar0822_get_interval(sensor, frame_length, &fi->interval);
+		*v4l2_subdev_state_get_interval(state, fi->pad) = fi->interval;
+	} else {
+		sensor->frame_interval = fi->interval;
+		sensor->vblank_user = false;
+		ar0822_apply_frame_interval(sensor);
+		ar0822_get_interval(sensor,
+				    sensor->mode.height + sensor->vblank->val,
+				    &fi->interval);
+	}
+
+	mutex_unlock(&sensor->mutex);
+
+	return 0;
+}
+
+/*
+ * Describe the stream of a source pad. The sensor sends both the image and
+ * the embedded data on virtual channel 0, see AR0822_REG_MIPI_F1_VC, and the
+ * embedded data type is the high byte of AR0822_REG_MIPI_F1_PDT. HDR
+ * exposures are merged on the sensor, the F2..F4 channels stay unused.
+ */
+static int ar0822_get_frame_desc(struct v4l2_subdev *sd, unsigned int pad,
+				 struct v4l2_mbus_frame_desc *fd)
+{
+	struct ar0822 *sensor = to_ar0822(sd);
+	struct v4l2_mbus_frame_desc_entry *entry = &fd->entry[0];
+
+	memset(fd, 0, sizeof(*fd));
+	fd->type = V4L2_MBUS_FRAME_DESC_TYPE_CSI2;
+	fd->num_entries = 1;
+
+	switch (pad) {
+	case IMAGE_PAD:
+		mutex_lock(&sensor->mutex);
+		entry->pixelcode = sensor->fmt_code;
+		entry->bus.csi2.dt =
+			ar0822_csi2_data_types[sensor->mode.bit_depth];
+		mutex_unlock(&sensor->mutex);
+		break;
+#ifdef AR0822_EMBEDDED_DATA_ENABLED
+	case METADATA_PAD:
+		entry->pixelcode = MEDIA_BUS_FMT_SENSOR_DATA;
+		entry->bus.csi2.dt = MIPI_CSI2_DT_EMBEDDED_8B;
+
+		/* No stream is sent with the embedded data disabled */
+		mutex_lock(&sensor->mutex);
+		if (sensor->mode.embedded_data == AR0822_EMBEDDED_DATA_OFF)
+			fd->num_entries = 0;
+		mutex_unlock(&sensor->mutex);
+		break;
+#endif // AR0822_EMBEDDED_DATA_ENABLED
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int ar0822_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+				  struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_FRAME_SYNC:
+		return v4l2_event_subscribe(fh, sub, AR0822_FRAME_SYNC_EVENTS,
+					    NULL);
+	default:
+		return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+	}
+}
+
 static const struct v4l2_subdev_core_ops ar0822_core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+	.subscribe_event = ar0822_subscribe_event,
 	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
@@ -1630,6 +3514,10 @@ static const struct v4l2_subdev_pad_ops ar0822_subdev_pad_ops = {
 	.get_fmt = ar0822_get_pad_format,
 	.set_fmt = ar0822_set_pad_format,
 	.get_selection = ar0822_get_selection,
+	.set_selection = ar0822_set_selection,
+	.get_frame_desc = ar0822_get_frame_desc,
+	.get_frame_interval = ar0822_get_frame_interval,
+	.set_frame_interval = ar0822_set_frame_interval,
 };
 
 static const struct v4l2_subdev_ops ar0822_subdev_ops = {
@@ -1691,9 +3579,12 @@ static int ar0822_power_on(struct ar0822 *sensor)
 {
 	int ret;
 	struct ar0822_hw_config *hw_config = &sensor->hw_config;
+	struct ar0822_stat_mark mark;
 
 	dev_dbg(sensor->dev, "%s\n", __func__);
 
+	ar0822_stat_begin(sensor, &mark);
+
 	ret = regulator_bulk_enable(AR0822_SUPPLY_AMOUNT, hw_config->supplies);
 	if (ret < 0)
 		return ret;
@@ -1706,6 +3597,8 @@ static int ar0822_power_on(struct ar0822 *sensor)
 
 	usleep_range(AR0822_RESET_DELAY_US_MIN, AR0822_RESET_DELAY_US_MAX);
 
+	ar0822_stat_end(sensor, AR0822_STAT_POWER_ON, &mark);
+
 	return 0;
 
 err_reset:
@@ -1721,6 +3614,11 @@ static void ar0822_power_off(struct ar0822 *sensor)
 	gpiod_set_value_cansleep(sensor->hw_config.gpio_reset, 0);
 	regulator_bulk_disable(AR0822_SUPPLY_AMOUNT,
 			       sensor->hw_config.supplies);
+
+	/* Register contents are lost, so is the shadow */
+	xa_destroy(&sensor->reg_shadow);
+	sensor->static_init_done = false;
+	sensor->standby = false;
 }
 
 static int ar0822_identify_model(struct ar0822 *sensor)
@@ -1868,6 +3766,83 @@ done_endpoint_free:
 	return ret;
 }
 
+/* Read the temperature sensor, only if the sensor is powered anyway */
+static int ar0822_read_temperature(struct ar0822 *sensor)
+{
+	u64 data, calib1, calib2;
+	int ret = 0;
+
+	if (pm_runtime_get_if_in_use(sensor->dev) <= 0)
+		return sensor->temp.valid ? 0 : -ENODATA;
+
+	cci_read(sensor->regmap, AR0822_REG_TEMPSENS1_DATA_REG, &data, &ret);
+	cci_read(sensor->regmap, AR0822_REG_TEMPSENS1_CALIB1, &calib1, &ret);
+	cci_read(sensor->regmap, AR0822_REG_TEMPSENS1_CALIB2, &calib2, &ret);
+	atomic64_add(3, &sensor->stats.transfers);
+
+	pm_runtime_mark_last_busy(sensor->dev);
+	pm_runtime_put_autosuspend(sensor->dev);
+
+	if (ret)
+		return ret;
+
+	if (ar0822_temperature(data, calib1, calib2, temp_calib1_millic,
+			       temp_calib2_millic, &sensor->temp.millic))
+		return -EIO;
+
+	sensor->temp.valid = true;
+	sensor->temp.updated = jiffies;
+
+	return 0;
+}
+
+/*
+ * The temperature is read at most once per AR0822_TEMP_CACHE_MS, and only
+ * while the sensor is powered, so polling it never wakes the sensor up. The
+ * same registers are part of the embedded data, see README.
+ */
+static int ar0822_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+			     u32 attr, int channel, long *val)
+{
+	struct ar0822 *sensor = dev_get_drvdata(dev);
+	int ret = 0;
+
+	mutex_lock(&sensor->mutex);
+
+	if (!sensor->temp.valid ||
+	    time_after(jiffies, sensor->temp.updated +
+					msecs_to_jiffies(AR0822_TEMP_CACHE_MS)))
+		ret = ar0822_read_temperature(sensor);
+
+	*val = sensor->temp.millic;
+
+	mutex_unlock(&sensor->mutex);
+
+	return ret;
+}
+
+static umode_t ar0822_hwmon_is_visible(const void *data,
+				       enum hwmon_sensor_types type, u32 attr,
+				       int channel)
+{
+	return 0444;
+}
+
+static const struct hwmon_channel_info *const ar0822_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(temp, HWMON_T_INPUT),
+	NULL
+};
+
+static const struct hwmon_ops ar0822_hwmon_ops = {
+	.is_visible = ar0822_hwmon_is_visible,
+	.read = ar0822_hwmon_read,
+};
+
+static const struct hwmon_chip_info ar0822_hwmon_chip_info = {
+	.ops = &ar0822_hwmon_ops,
+	.info = ar0822_hwmon_info,
+};
+
 static int ar0822_probe(struct i2c_client *client)
 {
 	struct ar0822 *sensor;
@@ -1878,6 +3853,10 @@ static int ar0822_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	sensor->dev = &client->dev;
+	xa_init(&sensor->reg_shadow);
+	INIT_DELAYED_WORK(&sensor->fctl.work, ar0822_fctl_work);
+	INIT_WORK(&sensor->ctrl_hold.work, ar0822_ctrl_hold_work);
+	spin_lock_init(&sensor->stats.lock);
 
 	dev_dbg(sensor->dev, "Probing AR0822 sensor\n");
 
@@ -1892,6 +3871,10 @@ static int ar0822_probe(struct i2c_client *client)
 	if (IS_ERR(sensor->regmap))
 		return PTR_ERR(sensor->regmap);
 
+	ret = ar0822_build_blobs(sensor);
+	if (ret)
+		return ret;
+
 	/*
 	 * Enable power management. The driver supports runtime PM, but needs to
 	 * work when runtime PM is disabled in the kernel. To that end, power
@@ -1904,7 +3887,7 @@ static int ar0822_probe(struct i2c_client *client)
 	pm_runtime_set_active(sensor->dev);
 	pm_runtime_get_noresume(sensor->dev);
 	pm_runtime_enable(sensor->dev);
-	pm_runtime_set_autosuspend_delay(sensor->dev, 1000);
+	pm_runtime_set_autosuspend_delay(sensor->dev, autosuspend_delay_ms);
 	pm_runtime_use_autosuspend(sensor->dev);
 
 	ret = ar0822_identify_model(sensor);
@@ -1926,6 +3909,26 @@ static int ar0822_probe(struct i2c_client *client)
 	pm_runtime_mark_last_busy(sensor->dev);
 	pm_runtime_put_autosuspend(sensor->dev);
 
+	/* The temperature is optional, the camera works without it */
+	if (IS_REACHABLE(CONFIG_HWMON)) {
+		struct device *hwmon;
+
+		hwmon = hwmon_device_register_with_info(sensor->dev, "ar0822",
+							sensor,
+							&ar0822_hwmon_chip_info,
+							NULL);
+		if (IS_ERR(hwmon))
+			dev_warn(sensor->dev,
+				 "failed to register hwmon device: %ld\n",
+				 PTR_ERR(hwmon));
+		else
+			sensor->hwmon = hwmon;
+	}
+
+	sensor->stats.debugfs = debugfs_create_file("ar0822_stats", 0444,
+						    client->debugfs, sensor,
+						    &ar0822_stats_fops);
+
 	return 0;
 
 err_power_off:
@@ -1941,8 +3944,13 @@ static void ar0822_remove(struct i2c_client *client)
 	struct v4l2_subdev *subdev = i2c_get_clientdata(client);
 	struct ar0822 *sensor = to_ar0822(subdev);
 
+	debugfs_remove(sensor->stats.debugfs);
+	if (sensor->hwmon)
+		hwmon_device_unregister(sensor->hwmon);
 	v4l2_async_unregister_subdev(subdev);
 	media_entity_cleanup(&subdev->entity);
+	cancel_delayed_work_sync(&sensor->fctl.work);
+	cancel_work_sync(&sensor->ctrl_hold.work);
 	ar0822_free_controls(sensor);
 
 	/*
@@ -1950,7 +3958,7 @@ static void ar0822_remove(struct i2c_client *client)
 	 * make sure to turn power off manually.
 	 */
 	pm_runtime_disable(sensor->dev);
-	if (!pm_runtime_status_suspended(sensor->dev))
+	if (!pm_runtime_status_suspended(sensor->dev) || sensor->standby)
 		ar0822_power_off(sensor);
 	pm_runtime_set_suspended(sensor->dev);
 }
@@ -1961,6 +3969,12 @@ static int ar0822_runtime_resume(struct device *dev)
 	struct v4l2_subdev *subdev = i2c_get_clientdata(client);
 	struct ar0822 *sensor = to_ar0822(subdev);
 
+	/* Registers were retained, skip the power up and reset delay */
+	if (sensor->standby) {
+		sensor->standby = false;
+		return 0;
+	}
+
 	return ar0822_power_on(sensor);
 }
 
@@ -1970,13 +3984,43 @@ static int ar0822_runtime_suspend(struct device *dev)
 	struct v4l2_subdev *subdev = i2c_get_clientdata(client);
 	struct ar0822 *sensor = to_ar0822(subdev);
 
+	/*
+	 * The sensor is not streaming here, which leaves it in software
+	 * standby. With keep_warm set it stays there with supplies and clock
+	 * enabled, so the next stream can start without a reset and re-init.
+	 */
+	if (keep_warm) {
+		sensor->standby = true;
+		return 0;
+	}
+
 	ar0822_power_off(sensor);
 
 	return 0;
 }
 
-static DEFINE_RUNTIME_DEV_PM_OPS(ar0822_pm_ops, ar0822_runtime_suspend,
-				 ar0822_runtime_resume, NULL);
+static int ar0822_system_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *subdev = i2c_get_clientdata(client);
+	struct ar0822 *sensor = to_ar0822(subdev);
+	int ret;
+
+	ret = pm_runtime_force_suspend(dev);
+	if (ret)
+		return ret;
+
+	/* Never keep the sensor powered across system sleep */
+	if (sensor->standby)
+		ar0822_power_off(sensor);
+
+	return 0;
+}
+
+static const struct dev_pm_ops ar0822_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(ar0822_system_suspend, pm_runtime_force_resume)
+	RUNTIME_PM_OPS(ar0822_runtime_suspend, ar0822_runtime_resume, NULL)
+};
 
 static const struct of_device_id ar0822_of_match[] = {
 	{ .compatible = "onnn,ar0822" },
@@ -1992,9 +4036,18 @@ static struct i2c_driver ar0822_driver = {
 		.name = "ar0822",
 		.of_match_table = ar0822_of_match,
 		.pm = pm_ptr(&ar0822_pm_ops),
+		/*
+		 * Power on, reset delay and identification don't depend on
+		 * other devices, let them overlap with other probes.
+		 */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
+#if IS_ENABLED(CONFIG_VIDEO_AR0822_KUNIT_TEST)
+#include "tests/ar0822_kunit.c"
+#endif
+
 module_i2c_driver(ar0822_driver);
 
 MODULE_DESCRIPTION("OnSemi AR0822 image sensor driver");
@@ -0,0 +1,653 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Stream start and control latency benchmark for the ar0822 driver.
+ *
+ * Copyright (C) 2025 Kurokesu UAB.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/media-bus-format.h>
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#define BENCH_BUFFERS 4
+#define BENCH_MODES_MAX 32
+#define BENCH_FRAMES_PER_CYCLE 8
+#define BENCH_DQBUF_TIMEOUT_MS 2000
+/* Frames without a change before a control is considered not applied */
+#define BENCH_LATENCY_FRAMES_MAX 16
+
+/* V4L2_CID_TEST_PATTERN menu entry of ar0822_test_pattern_menu */
+#define BENCH_TEST_PATTERN_SOLID_COLOR 1
+#define BENCH_TEST_PATTERN_COLOR_MAX 0xFFF
+
+struct bench_stat {
+	unsigned int count;
+	double min;
+	double max;
+	double total;
+};
+
+struct bench_mode {
+	uint32_t code;
+	uint32_t width;
+	uint32_t height;
+	struct bench_stat first_frame;
+	struct bench_stat stream_off;
+	struct bench_stat mode_switch;
+};
+
+struct bench_buffer {
+	void *data;
+	size_t length;
+};
+
+struct bench {
+	int subdev;
+	int video;
+	const char *hook;
+	unsigned int cycles;
+
+	struct bench_buffer buffers[BENCH_BUFFERS];
+	unsigned int buffers_amount;
+	/* Sequence and second byte of the last dequeued frame */
+	uint32_t sequence;
+	uint8_t probe;
+
+	struct bench_mode modes[BENCH_MODES_MAX];
+	unsigned int modes_amount;
+};
+
+static double bench_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void bench_stat_add(struct bench_stat *stat, double val)
+{
+	if (!stat->count || val < stat->min)
+		stat->min = val;
+	if (!stat->count || val > stat->max)
+		stat->max = val;
+
+	stat->total += val;
+	stat->count++;
+}
+
+static void bench_stat_print(const char *name, const char *unit,
+			     const struct bench_stat *stat)
+{
+	if (!stat->count) {
+		printf("  %-22s -\n", name);
+		return;
+	}
+
+	printf("  %-22s min %10.1f avg %10.1f max %10.1f %s (%u)\n", name,
+	       stat->min, stat->total / stat->count, stat->max, unit,
+	       stat->count);
+}
+
+static int bench_ioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static int bench_set_ctrls(int fd, struct v4l2_ext_control *ctrls,
+			   unsigned int amount)
+{
+	struct v4l2_ext_controls ext = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = amount,
+		.controls = ctrls,
+	};
+
+	return bench_ioctl(fd, VIDIOC_S_EXT_CTRLS, &ext);
+}
+
+static int bench_set_ctrl(int fd, uint32_t id, int32_t value)
+{
+	struct v4l2_ext_control ctrl = {
+		.id = id,
+		.value = value,
+	};
+
+	return bench_set_ctrls(fd, &ctrl, 1);
+}
+
+static uint32_t bench_pixel_format(uint32_t code)
+{
+	switch (code) {
+	case MEDIA_BUS_FMT_SGRBG10_1X10:
+		return V4L2_PIX_FMT_SGRBG10P;
+	case MEDIA_BUS_FMT_SGRBG12_1X12:
+		return V4L2_PIX_FMT_SGRBG12P;
+	case MEDIA_BUS_FMT_SGRBG10_DPCM8_1X8:
+		return V4L2_PIX_FMT_SGRBG10DPCM8;
+	default:
+		return 0;
+	}
+}
+
+/* Collect the image pad formats the sensor offers for the current link */
+static int bench_enum_modes(struct bench *bench)
+{
+	struct v4l2_subdev_mbus_code_enum code = {
+		.pad = 0,
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+	};
+
+	bench->modes_amount = 0;
+
+	for (code.index = 0;
+	     !bench_ioctl(bench->subdev, VIDIOC_SUBDEV_ENUM_MBUS_CODE, &code);
+	     code.index++) {
+		struct v4l2_subdev_frame_size_enum size = {
+			.pad = 0,
+			.code = code.code,
+			.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+		};
+
+		if (!bench_pixel_format(code.code))
+			continue;
+
+		for (size.index = 0;
+		     !bench_ioctl(bench->subdev, VIDIOC_SUBDEV_ENUM_FRAME_SIZE,
+				  &size);
+		     size.index++) {
+			struct bench_mode *mode;
+
+			if (bench->modes_amount >= BENCH_MODES_MAX)
+				return 0;
+
+			mode = &bench->modes[bench->modes_amount++];
+			memset(mode, 0, sizeof(*mode));
+			mode->code = code.code;
+			mode->width = size.max_width;
+			mode->height = size.max_height;
+		}
+	}
+
+	return bench->modes_amount ? 0 : -ENODEV;
+}
+
+static void bench_free_buffers(struct bench *bench)
+{
+	struct v4l2_requestbuffers req = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+		.count = 0,
+	};
+
+	for (unsigned int i = 0; i < bench->buffers_amount; i++)
+		munmap(bench->buffers[i].data, bench->buffers[i].length);
+
+	bench->buffers_amount = 0;
+	bench_ioctl(bench->video, VIDIOC_REQBUFS, &req);
+}
+
+static int bench_alloc_buffers(struct bench *bench)
+{
+	struct v4l2_requestbuffers req = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+		.count = BENCH_BUFFERS,
+	};
+
+	if (bench_ioctl(bench->video, VIDIOC_REQBUFS, &req))
+		return -errno;
+
+	for (unsigned int i = 0; i < req.count && i < BENCH_BUFFERS; i++) {
+		struct v4l2_buffer buf = {
+			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.memory = V4L2_MEMORY_MMAP,
+			.index = i,
+		};
+		void *data;
+
+		if (bench_ioctl(bench->video, VIDIOC_QUERYBUF, &buf))
+			goto error;
+
+		data = mmap(NULL, buf.length, PROT_READ, MAP_SHARED,
+			    bench->video, buf.m.offset);
+		if (data == MAP_FAILED)
+			goto error;
+
+		bench->buffers[i].data = data;
+		bench->buffers[i].length = buf.length;
+		bench->buffers_amount++;
+
+		if (bench_ioctl(bench->video, VIDIOC_QBUF, &buf))
+			goto error;
+	}
+
+	return 0;
+
+error:
+	bench_free_buffers(bench);
+	return -errno;
+}
+
+/* Dequeue one frame, remember its sequence and second byte, requeue it */
+static int bench_dqbuf(struct bench *bench)
+{
+	struct pollfd pfd = {
+		.fd = bench->video,
+		.events = POLLIN,
+	};
+	struct v4l2_buffer buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	int ret;
+
+	ret = poll(&pfd, 1, BENCH_DQBUF_TIMEOUT_MS);
+	if (ret <= 0)
+		return ret ? -errno : -ETIMEDOUT;
+
+	if (bench_ioctl(bench->video, VIDIOC_DQBUF, &buf))
+		return -errno;
+
+	/*
+	 * The packed formats start a line with the high bits of its first
+	 * pixels, the second byte belongs to the red pixel of GRBG.
+	 */
+	bench->sequence = buf.sequence;
+	if (buf.index < bench->buffers_amount && buf.bytesused > 1)
+		bench->probe = ((uint8_t *)bench->buffers[buf.index].data)[1];
+
+	if (bench_ioctl(bench->video, VIDIOC_QBUF, &buf))
+		return -errno;
+
+	return 0;
+}
+
+static int bench_set_format(struct bench *bench, struct bench_mode *mode,
+			    double *hook_us)
+{
+	struct v4l2_subdev_format sd_fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+		.pad = 0,
+		.format = {
+			.code = mode->code,
+			.width = mode->width,
+			.height = mode->height,
+			.field = V4L2_FIELD_NONE,
+		},
+	};
+	struct v4l2_format fmt = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.fmt.pix = {
+			.width = mode->width,
+			.height = mode->height,
+			.pixelformat = bench_pixel_format(mode->code),
+			.field = V4L2_FIELD_NONE,
+		},
+	};
+
+	*hook_us = 0;
+
+	if (bench_ioctl(bench->subdev, VIDIOC_SUBDEV_S_FMT, &sd_fmt))
+		return -errno;
+
+	/* Receivers with a media controller pipeline configure it here */
+	if (bench->hook) {
+		char cmd[512];
+		double start = bench_now_us();
+
+		snprintf(cmd, sizeof(cmd), "%s %u %u 0x%04x", bench->hook,
+			 mode->width, mode->height, mode->code);
+		if (system(cmd)) {
+			fprintf(stderr, "hook failed: %s\n", cmd);
+			return -EINVAL;
+		}
+
+		*hook_us = bench_now_us() - start;
+	}
+
+	if (bench_ioctl(bench->video, VIDIOC_S_FMT, &fmt))
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Start streaming and wait for the first frame. The time to the first frame
+ * covers power on, the mode setup and the first frame period of the sensor.
+ */
+static int bench_stream_on(struct bench *bench, double *first_frame_us)
+{
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	double start;
+	int ret;
+
+	ret = bench_alloc_buffers(bench);
+	if (ret)
+		return ret;
+
+	start = bench_now_us();
+
+	if (bench_ioctl(bench->video, VIDIOC_STREAMON, &type)) {
+		ret = -errno;
+		bench_free_buffers(bench);
+		return ret;
+	}
+
+	ret = bench_dqbuf(bench);
+	if (first_frame_us)
+		*first_frame_us = bench_now_us() - start;
+
+	return ret;
+}
+
+static double bench_stream_off(struct bench *bench)
+{
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	double start = bench_now_us();
+
+	bench_ioctl(bench->video, VIDIOC_STREAMOFF, &type);
+	start = bench_now_us() - start;
+
+	bench_free_buffers(bench);
+
+	return start;
+}
+
+/*
+ * Cycle through all modes. The mode switch latency runs from the stream off
+ * of the previous mode to the first frame of the next one, without the hook.
+ */
+static int bench_modes(struct bench *bench)
+{
+	double switch_start = 0;
+
+	for (unsigned int c = 0; c < bench->cycles; c++) {
+		for (unsigned int m = 0; m < bench->modes_amount; m++) {
+			struct bench_mode *mode = &bench->modes[m];
+			double first_frame_us, hook_us, stop_us, now;
+			int ret;
+
+			if (!switch_start)
+				switch_start = bench_now_us();
+
+			ret = bench_set_format(bench, mode, &hook_us);
+			if (!ret)
+				ret = bench_stream_on(bench, &first_frame_us);
+			if (ret) {
+				fprintf(stderr, "%ux%u 0x%04x: %s\n",
+					mode->width, mode->height, mode->code,
+					strerror(-ret));
+				return ret;
+			}
+
+			now = bench_now_us();
+			if (c || m)
+				bench_stat_add(&mode->mode_switch,
+					       now - switch_start - hook_us);
+			bench_stat_add(&mode->first_frame, first_frame_us);
+
+			for (unsigned int f = 1; f < BENCH_FRAMES_PER_CYCLE;
+			     f++)
+				bench_dqbuf(bench);
+
+			switch_start = bench_now_us();
+			stop_us = bench_stream_off(bench);
+			bench_stat_add(&mode->stream_off, stop_us);
+		}
+	}
+
+	return 0;
+}
+
+/* Stream start with eHDR toggled on and off, eHDR uses 12-bit output */
+static int bench_hdr(struct bench *bench, struct bench_stat *on,
+		     struct bench_stat *off)
+{
+	struct bench_mode mode = {
+		.code = MEDIA_BUS_FMT_SGRBG12_1X12,
+		.width = bench->modes[0].width,
+		.height = bench->modes[0].height,
+	};
+	int ret = 0;
+
+	for (unsigned int c = 0; c < bench->cycles * 2 && !ret; c++) {
+		int hdr = !(c & 1);
+		double first_frame_us, hook_us;
+
+		if (bench_set_ctrl(bench->subdev, V4L2_CID_WIDE_DYNAMIC_RANGE,
+				   hdr))
+			return -errno;
+
+		ret = bench_set_format(bench, &mode, &hook_us);
+		if (!ret)
+			ret = bench_stream_on(bench, &first_frame_us);
+		if (!ret)
+			bench_stat_add(hdr ? on : off, first_frame_us);
+
+		bench_stream_off(bench);
+	}
+
+	bench_set_ctrl(bench->subdev, V4L2_CID_WIDE_DYNAMIC_RANGE, 0);
+
+	return ret;
+}
+
+static int bench_query(int fd, uint32_t id, struct v4l2_query_ext_ctrl *qc)
+{
+	memset(qc, 0, sizeof(*qc));
+	qc->id = id;
+
+	return bench_ioctl(fd, VIDIOC_QUERY_EXT_CTRL, qc);
+}
+
+/* Bursts of exposure, gain and VBLANK updates while streaming */
+static int bench_ctrl_bursts(struct bench *bench, unsigned int amount,
+			     struct bench_stat *stat)
+{
+	static const uint32_t ids[] = {
+		V4L2_CID_EXPOSURE,
+		V4L2_CID_ANALOGUE_GAIN,
+		V4L2_CID_VBLANK,
+	};
+	struct v4l2_query_ext_ctrl qc[3];
+	struct v4l2_ext_control ctrls[3];
+
+	for (unsigned int i = 0; i < 3; i++) {
+		if (bench_query(bench->subdev, ids[i], &qc[i]))
+			return -errno;
+	}
+
+	for (unsigned int n = 0; n < amount; n++) {
+		double start;
+
+		/* Alternate between the minimum and a value above it */
+		for (unsigned int i = 0; i < 3; i++) {
+			int64_t val = qc[i].minimum;
+
+			if (n & 1)
+				val += (qc[i].maximum - qc[i].minimum) / 4;
+
+			ctrls[i].id = ids[i];
+			ctrls[i].value = val;
+		}
+
+		start = bench_now_us();
+		if (bench_set_ctrls(bench->subdev, ctrls, 3))
+			return -errno;
+		bench_stat_add(stat, bench_now_us() - start);
+
+		bench_dqbuf(bench);
+	}
+
+	return 0;
+}
+
+/*
+ * Measure in frames how long a control takes to show up in the output. The
+ * solid color test pattern makes the content deterministic, so a change of
+ * the red value marks the first frame the update applied to.
+ */
+static int bench_ctrl_latency(struct bench *bench, unsigned int amount,
+			      struct bench_stat *stat)
+{
+	int ret;
+
+	ret = bench_set_ctrl(bench->subdev, V4L2_CID_TEST_PATTERN_RED, 0);
+	for (unsigned int f = 0; f < 3 && !ret; f++)
+		ret = bench_dqbuf(bench);
+
+	for (unsigned int n = 0; n < amount && !ret; n++) {
+		int32_t red = n & 1 ? 0 : BENCH_TEST_PATTERN_COLOR_MAX;
+		uint8_t probe = bench->probe;
+		uint32_t sequence = bench->sequence;
+		unsigned int f;
+
+		ret = bench_set_ctrl(bench->subdev, V4L2_CID_TEST_PATTERN_RED,
+				     red);
+
+		for (f = 0; f < BENCH_LATENCY_FRAMES_MAX && !ret; f++) {
+			ret = bench_dqbuf(bench);
+			if (bench->probe != probe)
+				break;
+		}
+
+		if (!ret && f < BENCH_LATENCY_FRAMES_MAX)
+			bench_stat_add(stat, bench->sequence - sequence);
+	}
+
+	return ret;
+}
+
+static void bench_usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s -s <subdev> -v <video> [-n cycles] [-x hook]\n"
+		"\n"
+		"  -s  sensor subdev, e.g. /dev/v4l-subdev0\n"
+		"  -v  capture node of the receiver, e.g. /dev/video0\n"
+		"  -n  stream cycles per mode (default 5)\n"
+		"  -x  command run after each sensor format change, called\n"
+		"      with width, height and media bus code appended\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench = {
+		.cycles = 5,
+	};
+	struct bench_stat hdr_on = { 0 }, hdr_off = { 0 };
+	struct bench_stat bursts = { 0 }, latency = { 0 };
+	const char *subdev = NULL, *video = NULL;
+	double hook_us;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:v:n:x:h")) != -1) {
+		switch (opt) {
+		case 's':
+			subdev = optarg;
+			break;
+		case 'v':
+			video = optarg;
+			break;
+		case 'n':
+			bench.cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			bench.hook = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!subdev || !video || !bench.cycles) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	bench.subdev = open(subdev, O_RDWR);
+	bench.video = open(video, O_RDWR);
+	if (bench.subdev < 0 || bench.video < 0) {
+		perror("open");
+		return 1;
+	}
+
+	if (bench_set_ctrl(bench.subdev, V4L2_CID_TEST_PATTERN,
+			   BENCH_TEST_PATTERN_SOLID_COLOR)) {
+		perror("test pattern");
+		return 1;
+	}
+
+	ret = bench_enum_modes(&bench);
+	if (ret) {
+		fprintf(stderr, "no supported modes: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	ret = bench_modes(&bench);
+	if (ret)
+		return 1;
+
+	ret = bench_hdr(&bench, &hdr_on, &hdr_off);
+	if (ret)
+		fprintf(stderr, "eHDR: %s\n", strerror(-ret));
+
+	/* Controls are measured on the first mode */
+	ret = bench_set_format(&bench, &bench.modes[0], &hook_us);
+	if (!ret)
+		ret = bench_stream_on(&bench, NULL);
+	if (!ret)
+		ret = bench_ctrl_bursts(&bench, bench.cycles * 20, &bursts);
+	if (!ret)
+		ret = bench_ctrl_latency(&bench, bench.cycles * 4, &latency);
+	if (ret)
+		fprintf(stderr, "controls: %s\n", strerror(-ret));
+	bench_stream_off(&bench);
+
+	bench_set_ctrl(bench.subdev, V4L2_CID_TEST_PATTERN, 0);
+
+	for (unsigned int m = 0; m < bench.modes_amount; m++) {
+		struct bench_mode *mode = &bench.modes[m];
+
+		printf("%ux%u code 0x%04x\n", mode->width, mode->height,
+		       mode->code);
+		bench_stat_print("first frame", "us", &mode->first_frame);
+		bench_stat_print("mode switch", "us", &mode->mode_switch);
+		bench_stat_print("stream off", "us", &mode->stream_off);
+	}
+
+	printf("eHDR\n");
+	bench_stat_print("first frame, on", "us", &hdr_on);
+	bench_stat_print("first frame, off", "us", &hdr_off);
+
+	printf("controls\n");
+	bench_stat_print("S_EXT_CTRLS", "us", &bursts);
+	bench_stat_print("frame latency", "frames", &latency);
+
+	close(bench.video);
+	close(bench.subdev);
+
+	return 0;
+}
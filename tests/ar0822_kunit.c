@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests of the AR0822 timing model and register table packing.
+ *
+ * Included from ar0822.c, so the static helpers are tested directly, see
+ * tests/Kconfig for how to enable it.
+ *
+ * Copyright (C) 2025 Kurokesu UAB.
+ */
+
+#include <kunit/test.h>
+#include <linux/units.h>
+
+struct ar0822_test_ctx {
+	struct ar0822 sensor;
+	struct v4l2_ctrl hblank;
+	struct v4l2_ctrl hdr_ratio_t1_t2;
+	struct v4l2_ctrl hdr_ratio_t2_t3;
+};
+
+/*
+ * Minimum line and frame length of a mode at its default crop, with 4
+ * embedded data lines and the default 16x HDR ratios. The frame rate is in
+ * millihertz, the exposure limit in lines at the minimum frame length.
+ *
+ * The 1920x1080 and 3840x2160 entries are the validated limits formerly
+ * listed per format, the other ones follow the timing model.
+ */
+struct ar0822_timing_case {
+	unsigned int link_mhz;
+	unsigned int width;
+	unsigned int height;
+	unsigned int lanes;
+	unsigned int bit_depth;
+	bool hdr;
+	unsigned int llpck;
+	unsigned int fll;
+	unsigned int mfps;
+	unsigned int exposure_max;
+};
+
+static const struct ar0822_timing_case ar0822_timing_cases[] = {
+	/* link, width, height, lanes, depth, hdr, llpck, fll, mfps, exposure */
+	{ 480, 1920, 1080, 2, 10, false, 1812, 1122, 78698, 1118 },
+	{ 480, 1920, 1080, 2, 12, false, 2142, 1122, 66574, 1118 },
+	{ 480, 1920, 1080, 2, 12, true, 2372, 1404, 48043, 1290 },
+	{ 480, 1920, 1080, 4, 10, false, 1012, 1316, 120138, 1312 },
+	{ 480, 1920, 1080, 4, 12, false, 1180, 1128, 120206, 1124 },
+	{ 480, 1920, 1080, 4, 12, true, 2372, 1404, 48043, 1290 },
+	{ 480, 3840, 2160, 2, 10, false, 3412, 2206, 21257, 2202 },
+	{ 480, 3840, 2160, 2, 12, false, 4062, 2206, 17855, 2202 },
+	{ 480, 3840, 2160, 2, 12, true, 4062, 2338, 16847, 2048 },
+	{ 480, 3840, 2160, 4, 10, false, 1812, 2206, 40027, 2202 },
+	{ 480, 3840, 2160, 4, 12, false, 2140, 2206, 33892, 2202 },
+	{ 480, 3840, 2160, 4, 12, true, 2372, 2248, 30006, 692 },
+	{ 480, 960, 540, 2, 10, false, 1012, 586, 269799, 582 },
+	{ 480, 960, 540, 2, 12, false, 1182, 586, 230996, 582 },
+	{ 480, 960, 540, 2, 12, true, 2372, 626, 107753, 560 },
+	{ 480, 960, 540, 4, 10, false, 792, 586, 344744, 582 },
+	{ 480, 960, 540, 4, 12, false, 792, 586, 344744, 582 },
+	{ 480, 960, 540, 4, 12, true, 2372, 626, 107753, 560 },
+	{ 480, 3840, 1080, 2, 10, false, 3412, 1126, 41645, 1122 },
+	{ 480, 3840, 1080, 2, 12, false, 4062, 1126, 34981, 1122 },
+	{ 480, 3840, 1080, 2, 12, true, 4062, 1166, 33781, 692 },
+	{ 480, 3840, 1080, 4, 10, false, 1812, 1126, 78419, 1122 },
+	{ 480, 3840, 1080, 4, 12, false, 2142, 1126, 66337, 1122 },
+	{ 480, 3840, 1080, 4, 12, true, 2372, 1166, 57850, 692 },
+	{ 960, 1920, 1080, 2, 10, false, 984, 2712, 59956, 2708 },
+	{ 960, 1920, 1080, 2, 12, false, 1146, 2328, 59972, 2324 },
+	{ 960, 1920, 1080, 2, 12, true, 2376, 1402, 48031, 1288 },
+	{ 960, 1920, 1080, 4, 10, false, 792, 3360, 60125, 3356 },
+	{ 960, 1920, 1080, 4, 12, false, 792, 3360, 60125, 3356 },
+	{ 960, 1920, 1080, 4, 12, true, 2376, 1402, 48031, 1288 },
+	{ 960, 3840, 2160, 2, 10, false, 1782, 2184, 41111, 2180 },
+	{ 960, 3840, 2160, 2, 12, false, 2106, 2184, 34786, 2180 },
+	{ 960, 3840, 2160, 2, 12, true, 2376, 2248, 29955, 692 },
+	{ 960, 3840, 2160, 4, 10, false, 982, 2672, 60977, 2668 },
+	{ 960, 3840, 2160, 4, 12, false, 1146, 2288, 61021, 2284 },
+	{ 960, 3840, 2160, 4, 12, true, 2376, 2248, 29955, 692 },
+	{ 960, 960, 540, 2, 10, false, 792, 840, 240500, 836 },
+	{ 960, 960, 540, 2, 12, false, 792, 840, 240500, 836 },
+	{ 960, 960, 540, 2, 12, true, 2376, 626, 107571, 560 },
+	{ 960, 960, 540, 4, 10, false, 792, 840, 240500, 836 },
+	{ 960, 960, 540, 4, 12, false, 792, 840, 240500, 836 },
+	{ 960, 960, 540, 4, 12, true, 2376, 626, 107571, 560 },
+	{ 960, 3840, 1080, 2, 10, false, 1784, 1104, 81237, 1100 },
+	{ 960, 3840, 1080, 2, 12, false, 2106, 1104, 68816, 1100 },
+	{ 960, 3840, 1080, 2, 12, true, 2376, 1166, 57753, 692 },
+	{ 960, 3840, 1080, 4, 10, false, 984, 1353, 120178, 1349 },
+	{ 960, 3840, 1080, 4, 12, false, 1146, 1162, 120151, 1158 },
+	{ 960, 3840, 1080, 4, 12, true, 2376, 1166, 57753, 692 },
+};
+
+static void ar0822_timing_case_desc(const struct ar0822_timing_case *c,
+				    char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%u MHz %ux%u %u lanes %u-bit%s",
+		 c->link_mhz, c->width, c->height, c->lanes, c->bit_depth,
+		 c->hdr ? " hdr" : "");
+}
+
+KUNIT_ARRAY_PARAM(ar0822_timing, ar0822_timing_cases, ar0822_timing_case_desc);
+
+static struct ar0822_test_ctx *ar0822_test_ctx_alloc(struct kunit *test)
+{
+	struct ar0822_test_ctx *ctx;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+
+	ctx->hdr_ratio_t1_t2.val = AR0822_HDR_RATIO_DEFAULT;
+	ctx->hdr_ratio_t2_t3.val = AR0822_HDR_RATIO_DEFAULT;
+	ctx->sensor.hdr_ratio_t1_t2 = &ctx->hdr_ratio_t1_t2;
+	ctx->sensor.hdr_ratio_t2_t3 = &ctx->hdr_ratio_t2_t3;
+
+	return ctx;
+}
+
+/* Select the PLL configuration, format and lanes of a test case */
+static void ar0822_test_set_mode(struct kunit *test, struct ar0822 *sensor,
+				 const struct ar0822_timing_case *c)
+{
+	struct ar0822_pll_config const *pll_config = NULL;
+	struct ar0822_format const *format = NULL;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(ar0822_pll_configs); i++) {
+		s64 freq_link = *ar0822_pll_configs[i].freq_link;
+
+		if (freq_link == c->link_mhz * HZ_PER_MHZ)
+			pll_config = &ar0822_pll_configs[i];
+	}
+	KUNIT_ASSERT_NOT_NULL(test, pll_config);
+
+	for (unsigned int i = 0; i < pll_config->formats_amount; i++)
+		if (pll_config->formats[i].width == c->width &&
+		    pll_config->formats[i].height == c->height)
+			format = &pll_config->formats[i];
+	KUNIT_ASSERT_NOT_NULL(test, format);
+
+	sensor->pll_config = pll_config;
+	sensor->hw_config.num_data_lanes = c->lanes;
+	sensor->hw_config.lane_mode = c->lanes == 4 ? AR0822_LANE_MODE_ID_4 :
+						      AR0822_LANE_MODE_ID_2;
+
+	ar0822_set_mode_format(sensor, format);
+	sensor->mode.bit_depth = c->bit_depth == 12 ?
+					 AR0822_BIT_DEPTH_ID_12BIT :
+					 AR0822_BIT_DEPTH_ID_10BIT;
+	sensor->mode.hdr = c->hdr;
+	sensor->mode.embedded_data = AR0822_EMBEDDED_DATA_REGS_STATS;
+}
+
+static void ar0822_test_timing(struct kunit *test)
+{
+	const struct ar0822_timing_case *c = test->param_value;
+	struct ar0822_test_ctx *ctx = ar0822_test_ctx_alloc(test);
+	struct ar0822 *sensor = &ctx->sensor;
+	struct ar0822_timing timing;
+	struct v4l2_fract interval;
+
+	ar0822_test_set_mode(test, sensor, c);
+
+	ar0822_get_timing(sensor, &timing);
+	KUNIT_EXPECT_EQ(test, timing.line_length_pck_min, c->llpck);
+	KUNIT_EXPECT_EQ(test, timing.frame_length_lines_min, c->fll);
+
+	/* The limits have to fit the registers and leave room to expose */
+	KUNIT_EXPECT_LE(test, timing.line_length_pck_min,
+			AR0822_LINE_LENGTH_PCK_MAX);
+	KUNIT_EXPECT_LE(test, timing.frame_length_lines_min, AR0822_FLL_MAX);
+	KUNIT_EXPECT_GE(test, timing.frame_length_lines_min,
+			sensor->mode.height + AR0822_EXPOSURE_MARGIN +
+				AR0822_EXPOSURE_MIN);
+
+	/* Frame interval at the minimum line and frame length */
+	ctx->hblank.val = timing.line_length_pck_min - sensor->mode.width;
+	sensor->hblank = &ctx->hblank;
+	ar0822_get_interval(sensor, timing.frame_length_lines_min, &interval);
+	KUNIT_ASSERT_NE(test, interval.numerator, 0);
+	KUNIT_EXPECT_EQ(test, div_u64((u64)interval.denominator * 1000,
+				      interval.numerator),
+			c->mfps);
+
+	KUNIT_EXPECT_EQ(test,
+			ar0822_exposure_max(sensor,
+					    timing.frame_length_lines_min),
+			c->exposure_max);
+}
+
+/* A cropped window without embedded data follows the timing model */
+static void ar0822_test_timing_crop(struct kunit *test)
+{
+	static const struct ar0822_timing_case c = {
+		.link_mhz = 480,
+		.width = 3840,
+		.height = 2160,
+		.lanes = 2,
+		.bit_depth = 10,
+	};
+	struct ar0822_test_ctx *ctx = ar0822_test_ctx_alloc(test);
+	struct ar0822 *sensor = &ctx->sensor;
+	struct ar0822_timing timing;
+
+	ar0822_test_set_mode(test, sensor, &c);
+	sensor->mode.crop.width = 1920;
+	sensor->mode.crop.height = 1080;
+	sensor->mode.width = 1920;
+	sensor->mode.height = 1080;
+	sensor->mode.embedded_data = AR0822_EMBEDDED_DATA_OFF;
+
+	/* 1600 for the link plus the overhead, 1080 rows + 42 lines VBLANK */
+	ar0822_get_timing(sensor, &timing);
+	KUNIT_EXPECT_EQ(test, timing.line_length_pck_min, 1812);
+	KUNIT_EXPECT_EQ(test, timing.frame_length_lines_min, 1122);
+
+	/* Longer lines don't shorten a frame limited by its rows */
+	ctx->hblank.val = 4000 - sensor->mode.width;
+	sensor->hblank = &ctx->hblank;
+	ar0822_get_timing(sensor, &timing);
+	KUNIT_EXPECT_EQ(test, timing.line_length_pck_min, 1812);
+	KUNIT_EXPECT_EQ(test, timing.frame_length_lines_min, 1122);
+}
+
+/* Longest T1 exposure in HDR mode, see ar0822_hdr_exposure_max() */
+struct ar0822_hdr_exposure_case {
+	u32 fll;
+	u32 rows;
+	u32 r1;
+	u32 r2;
+	u32 exposure_max;
+};
+
+static const struct ar0822_hdr_exposure_case ar0822_hdr_exposure_cases[] = {
+	/* T2 + T3 <= vblank - 28: 46 * 256 / 17 */
+	{ 2248, 2174, 16, 16, 692 },
+	{ 2248, 2174, 2, 2, 61 },
+	/* T1 + T2 + T3 + 28 <= fll: 1376 * 256 / 273 */
+	{ 1404, 1092, 16, 16, 1290 },
+	{ 100, 10, 2, 2, 41 },
+	/* T2 + 2 * T3 <= 144: 144 * 256 / 18 */
+	{ 3000, 2174, 16, 16, 2048 },
+	{ 4000, 1092, 2, 2, 144 },
+	{ 4000, 1092, 4, 8, 460 },
+};
+
+static void ar0822_hdr_exposure_case_desc(
+	const struct ar0822_hdr_exposure_case *c, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "fll %u rows %u ratios %u %u",
+		 c->fll, c->rows, c->r1, c->r2);
+}
+
+KUNIT_ARRAY_PARAM(ar0822_hdr_exposure, ar0822_hdr_exposure_cases,
+		  ar0822_hdr_exposure_case_desc);
+
+static void ar0822_test_hdr_exposure_max(struct kunit *test)
+{
+	const struct ar0822_hdr_exposure_case *c = test->param_value;
+
+	KUNIT_EXPECT_EQ(test, ar0822_hdr_exposure_max(c->fll, c->rows, c->r1,
+						      c->r2),
+			c->exposure_max);
+}
+
+/* Pack a table into test allocated buffers, see ar0822_pack_alloc() */
+static struct ar0822_packed_seq *
+ar0822_test_pack(struct kunit *test, struct ar0822_reg_sequence const *seq)
+{
+	struct ar0822_packed_seq *packed;
+	unsigned int len = 0;
+
+	for (unsigned int i = 0; i < seq->amount; i++)
+		len += CCI_REG_WIDTH_BYTES(seq->regs[i].reg);
+
+	packed = kunit_kzalloc(test, sizeof(*packed), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, packed);
+	packed->seq = seq;
+	packed->bursts = kunit_kcalloc(test, max(seq->amount, 1U),
+				       sizeof(*packed->bursts), GFP_KERNEL);
+	packed->data = kunit_kzalloc(test, max(len, 1U), GFP_KERNEL);
+	packed->superseded = kunit_kcalloc(test,
+					   max(BITS_TO_LONGS(seq->amount), 1UL),
+					   sizeof(unsigned long), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, packed->bursts);
+	KUNIT_ASSERT_NOT_NULL(test, packed->data);
+	KUNIT_ASSERT_NOT_NULL(test, packed->superseded);
+
+	ar0822_pack_seq(packed);
+
+	return packed;
+}
+
+/*
+ * Unpack the bursts and compare them to the table: every register in order,
+ * at consecutive addresses within a burst, and bursts only split where the
+ * addresses aren't consecutive.
+ */
+static void ar0822_test_unpack(struct kunit *test,
+			       struct ar0822_packed_seq const *packed)
+{
+	struct ar0822_reg_sequence const *seq = packed->seq;
+	unsigned int i = 0;
+	u32 end = 0;
+
+	for (unsigned int b = 0; b < packed->bursts_amount; b++) {
+		struct ar0822_reg_burst const *burst = &packed->bursts[b];
+		u8 const *data = packed->data + burst->offset;
+		u32 addr = burst->addr;
+
+		if (b)
+			KUNIT_EXPECT_NE(test, (u32)burst->addr, end);
+		KUNIT_EXPECT_EQ(test, burst->first, i);
+		KUNIT_ASSERT_LE(test, i + burst->amount, seq->amount);
+
+		for (unsigned int r = 0; r < burst->amount; r++, i++) {
+			u32 reg = seq->regs[i].reg;
+			unsigned int width = CCI_REG_WIDTH_BYTES(reg);
+			u64 val = 0;
+
+			KUNIT_EXPECT_EQ(test, (u32)CCI_REG_ADDR(reg), addr);
+			for (unsigned int w = 0; w < width; w++)
+				val = val << 8 | *data++;
+			KUNIT_EXPECT_EQ(test, val, seq->regs[i].val);
+
+			addr += width;
+		}
+
+		KUNIT_EXPECT_EQ(test, addr - burst->addr, (u32)burst->len);
+		end = addr;
+	}
+
+	KUNIT_EXPECT_EQ(test, i, seq->amount);
+
+	for (i = 0; i < seq->amount; i++) {
+		bool later = false;
+
+		for (unsigned int j = i + 1; j < seq->amount; j++)
+			if (seq->regs[j].reg == seq->regs[i].reg)
+				later = true;
+
+		KUNIT_EXPECT_EQ(test, test_bit(i, packed->superseded), later);
+	}
+}
+
+static void ar0822_test_pack_seq(struct kunit *test)
+{
+	static const struct cci_reg_sequence regs[] = {
+		{ CCI_REG16(0x3000), 0x1234 },
+		{ CCI_REG16(0x3002), 0x5678 },
+		{ CCI_REG8(0x3010), 0xAB },
+		{ CCI_REG8(0x3011), 0xCD },
+		{ CCI_REG16(0x3002), 0x9ABC },
+	};
+	static const struct ar0822_reg_sequence seq = AR0822_REG_SEQ(regs);
+	static const u8 data[] = { 0x12, 0x34, 0x56, 0x78, 0xAB,
+				   0xCD, 0x9A, 0xBC };
+	struct ar0822_packed_seq *packed = ar0822_test_pack(test, &seq);
+
+	KUNIT_ASSERT_EQ(test, packed->bursts_amount, 3);
+	KUNIT_EXPECT_EQ(test, packed->bursts[0].addr, 0x3000);
+	KUNIT_EXPECT_EQ(test, packed->bursts[0].len, 4);
+	KUNIT_EXPECT_EQ(test, packed->bursts[1].addr, 0x3010);
+	KUNIT_EXPECT_EQ(test, packed->bursts[1].len, 2);
+	KUNIT_EXPECT_EQ(test, packed->bursts[2].addr, 0x3002);
+	KUNIT_EXPECT_EQ(test, packed->bursts[2].len, 2);
+	KUNIT_EXPECT_MEMEQ(test, packed->data, data, sizeof(data));
+	KUNIT_EXPECT_TRUE(test, test_bit(1, packed->superseded));
+
+	ar0822_test_unpack(test, packed);
+}
+
+static void ar0822_test_repack(struct kunit *test,
+			       struct ar0822_reg_sequence const *seq)
+{
+	ar0822_test_unpack(test, ar0822_test_pack(test, seq));
+}
+
+/* All register tables of the driver survive packing unchanged */
+static void ar0822_test_pack_tables(struct kunit *test)
+{
+	ar0822_test_repack(test, &ar0822_seq_common);
+	ar0822_test_repack(test, &ar0822_seq_mfr_common);
+	ar0822_test_repack(test, &ar0822_seq_mfr_hdr);
+	ar0822_test_repack(test, &ar0822_seq_hdr);
+
+	for (unsigned int p = 0; p < ARRAY_SIZE(ar0822_pll_configs); p++) {
+		struct ar0822_pll_config const *pll_config =
+			&ar0822_pll_configs[p];
+
+		ar0822_test_repack(test, &pll_config->regs_pll);
+
+		for (unsigned int b = 0; b < AR0822_BIT_DEPTH_ID_AMOUNT; b++)
+			ar0822_test_repack(test, &pll_config->regs_mipi[b]);
+
+		for (unsigned int f = 0; f < pll_config->formats_amount; f++) {
+			struct ar0822_format const *format =
+				&pll_config->formats[f];
+
+			ar0822_test_repack(test, &format->reg_sequence);
+		}
+	}
+}
+
+static struct kunit_case ar0822_test_cases[] = {
+	KUNIT_CASE_PARAM(ar0822_test_timing, ar0822_timing_gen_params),
+	KUNIT_CASE(ar0822_test_timing_crop),
+	KUNIT_CASE_PARAM(ar0822_test_hdr_exposure_max,
+			 ar0822_hdr_exposure_gen_params),
+	KUNIT_CASE(ar0822_test_pack_seq),
+	KUNIT_CASE(ar0822_test_pack_tables),
+	{}
+};
+
+static struct kunit_suite ar0822_test_suite = {
+	.name = "ar0822",
+	.test_cases = ar0822_test_cases,
+};
+
+kunit_test_suite(ar0822_test_suite);